@@ -0,0 +1,205 @@
+#include "batch.h"
+
+#include "opencv2/opencv.hpp"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QThread>
+#include <QElapsedTimer>
+
+#include <iostream>
+#include <sstream>
+#include <deque>
+#include <algorithm>
+
+using namespace cv;
+using namespace std;
+
+const float BATCH_THRESHOLD = 0.7f;
+const int RESULT_WAIT = 10;         //ms to wait for a result while the detect queue is full
+
+/*
+  quotes a CSV field as RFC 4180 asks when it holds a comma, quote or line break, quotes doubled
+  @params - field
+  @returns - field as it goes in the line
+*/
+static string csvField(const string &field)
+{
+    if (field.find_first_of(",\"\r\n") == string::npos){
+        return field;
+    }
+    string quoted = "\"";
+    for (size_t i = 0; i < field.size(); i++){
+        if (field[i] == '"'){
+            quoted += '"';
+        }
+        quoted += field[i];
+    }
+    return quoted + "\"";
+}
+
+batchProcessor::batchProcessor(detectObject &detection, recognition &faceRecognition, faceGallery *gallery,
+                               const string user)
+    : detection(detection), faceRecognition(faceRecognition), gallery(gallery), user(user)
+{
+    threshold = BATCH_THRESHOLD;
+    nextFile = 0;
+    frameIndex = 0;
+    out = NULL;
+    faces = 0;
+    matches = 0;
+}
+
+/*
+  runs every item of the source through the pipeline, frames are read on this thread
+  while detection, preprocessing and recognition use the rest of the cores
+  @params - source(image directory or video file); output(results file, stdout if empty)
+  @returns - items processed, -1 on error
+*/
+int batchProcessor::run(const string source, const string output)
+{
+    if (!open(source)){
+        cout << "Could not open batch source: " << source << endl;
+        return -1;
+    }
+    out = output.empty() ? stdout : fopen(output.c_str(), "w");
+    if (out == NULL){
+        fprintf(stderr, "Could not write: %s\n", output.c_str());
+        return -1;
+    }
+    fprintf(out, "item,source,face,identity,name,similarity,detect_ms,align_ms,recognise_ms,total_ms\n");
+
+    //reader thread aside, detection gets most of the cores
+    int cores = max(1, QThread::idealThreadCount());
+    int alignWorkers = max(1, cores / 4);
+    int detectWorkers = max(1, cores - alignWorkers - 1);
+    recognitionPipeline pipeline(detection, faceRecognition, gallery);
+    pipeline.start(detectWorkers, alignWorkers, 1);
+    if (!video.isOpened()){
+        //unrelated stills, search every image in full
+        pipeline.tracker.refreshInterval = 0;
+    }
+
+    QElapsedTimer wall;
+    wall.start();
+    deque<string> names;        //source name per submitted item, results come back in the same order
+    int items = 0;
+    faces = matches = 0;
+    Mat frame;
+    string name;
+    pipelineItem result;
+    while (next(frame, name)){
+        while (!pipeline.submit(frame, 0)){
+            if (pipeline.nextResult(result, RESULT_WAIT)){
+                write(result, names.front());
+                names.pop_front();
+            }
+        }
+        names.push_back(name);
+        items++;
+        while (pipeline.nextResult(result)){
+            write(result, names.front());
+            names.pop_front();
+        }
+    }
+    while (pipeline.inFlight() > 0){
+        if (pipeline.nextResult(result, RESULT_WAIT)){
+            write(result, names.front());
+            names.pop_front();
+        }
+    }
+    pipeline.stop();
+    double seconds = wall.nsecsElapsed() / 1000000000.0;
+
+    if (out != stdout){
+        fclose(out);
+    }
+    out = NULL;
+    video.release();
+
+    cout << "Batch: " << items << " items, " << faces << " faces, " << matches << " matches in "
+         << seconds << "s (" << (seconds > 0 ? items / seconds : 0) << " items/s, "
+         << detectWorkers << " detect / " << alignWorkers << " align threads)" << endl;
+    return items;
+}
+
+/*
+  a directory is read as images in name order, anything else is opened as a video
+  @params - source
+  @returns - false if the source can't be read
+*/
+bool batchProcessor::open(const string source)
+{
+    files.clear();
+    nextFile = 0;
+    frameIndex = 0;
+    QFileInfo info(QString::fromStdString(source));
+    if (info.isDir()){
+        QDir dir(info.absoluteFilePath());
+        directory = dir.absolutePath().toStdString() + "/";
+        files = dir.entryList(QStringList() << "*.png" << "*.jpg" << "*.jpeg" << "*.bmp" << "*.pgm",
+                              QDir::Files, QDir::Name);
+        return !files.isEmpty();
+    }
+    try{
+        video.open(source);
+    }catch(cv::Exception &e){}
+    return video.isOpened();
+}
+
+/*
+  reads the next image or video frame, unreadable images are reported and skipped
+  @params - frame(out); name(out, file name or frame number)
+  @returns - false once the source is exhausted
+*/
+bool batchProcessor::next(Mat &frame, string &name)
+{
+    if (video.isOpened()){
+        //a fresh Mat each frame, the last one may still be in the pipeline
+        frame = Mat();
+        if (!video.read(frame) || frame.empty()){
+            return false;
+        }
+        ostringstream index;
+        index << frameIndex++;
+        name = index.str();
+        return true;
+    }
+    while (nextFile < files.size()){
+        name = files[nextFile++].toStdString();
+        try{
+            frame = imread(directory + name, 1);
+        }catch(cv::Exception &e){
+            frame = Mat();
+        }
+        if (!frame.empty()){
+            return true;
+        }
+        cout << "Could not load: " << directory << name << endl;
+    }
+    return false;
+}
+
+/*
+  one CSV line per item, identity is -1 and similarity empty when no face was found
+  @params - item(pipeline result); name(source item)
+*/
+void batchProcessor::write(const pipelineItem &item, const string &name)
+{
+    bool found = !item.face.empty();
+    bool matched = found && item.similarity < threshold;
+    faces += found;
+    matches += matched;
+
+    string identityName;
+    if (matched){
+        identityName = (gallery != NULL) ? gallery->name(item.identity) : user;
+    }
+    fprintf(out, "%d,%s,%d,%d,%s,", item.ticket, csvField(name).c_str(), found ? 1 : 0, matched ? item.identity : -1,
+            csvField(identityName).c_str());
+    if (found){
+        fprintf(out, "%.4f", item.similarity);
+    }
+    fprintf(out, ",%.3f,%.3f,%.3f,%.3f\n", item.stageMs[DETECT_STAGE], item.stageMs[ALIGN_STAGE],
+            item.stageMs[RECOGNISE_STAGE], item.timer.nsecsElapsed() / 1000000.0);
+}
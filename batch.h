@@ -0,0 +1,57 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "detectobject.h"
+#include "recognition.h"
+#include "gallery.h"
+#include "pipeline.h"
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/highgui/highgui.hpp"
+
+#include <QStringList>
+
+#include <cstdio>
+#include <string>
+
+using namespace cv;
+using namespace std;
+
+/*
+  Headless run over a directory of images or a video file: every image/frame goes through
+  the recognition pipeline on all cores and one result line per item is written, no GUI.
+*/
+class batchProcessor
+{
+public:
+    // gallery = NULL verifies against the single user the recogniser was trained on
+    batchProcessor(detectObject &detection, recognition &faceRecognition, faceGallery *gallery = NULL,
+                   const string user = "");
+
+    // returns the number of items processed, -1 if the source or output can't be opened
+    int run(const string source, const string output = "");
+
+    double threshold;           // similarity below this counts as a match
+
+private:
+    bool open(const string source);
+    bool next(Mat &frame, string &name);
+    void write(const pipelineItem &item, const string &name);
+
+    detectObject &detection;
+    recognition &faceRecognition;
+    faceGallery *gallery;
+    string user;
+
+    QStringList files;          // directory source
+    string directory;
+    int nextFile;
+    VideoCapture video;         // video source
+    int frameIndex;
+
+    FILE *out;
+    int faces;
+    int matches;
+};
+
+#endif // BATCH_H
@@ -0,0 +1,603 @@
+#include "detectobject.h"
+#include "recognition.h"
+#include "facefilters.h"
+#include "v4l2camera.h"
+
+#include "opencv2/opencv.hpp"
+#include "opencv2/highgui/highgui.hpp"
+
+#include <QDir>
+#include <QStringList>
+#include <QElapsedTimer>
+
+#include <iostream>
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+using namespace cv;
+using namespace std;
+
+/*
+  Replays the images in faces/ (camera frames) and ProcessedFaces/ (preprocessed faces)
+  through each stage and reports latency percentiles, throughput and heap allocations per call.
+  --verify only compares the facefilters kernels with the OpenCV calls they replace, and
+  equalizeLeftAndRightHalves with its per pixel reference, and exits non zero if any differs by
+  more than FACE_FILTER_TOLERANCE, short enough to run under qemu-arm.
+  --fast-preprocess 0|1 overrides detectObject::fastPreprocess for the processImage stage.
+  --capture file.raw only checks the native capture backend's grey frames and preview against a
+  file of raw frames (--capture-format GREY|NV12|YU12|YUYV, --capture-size WIDTHxHEIGHT) and exits.
+  Usage: ./benchmark [--faces dir] [--processed dir] [--iterations n] [--output file.json]
+                     [--fast-preprocess 0|1] [--verify]
+                     [--capture file.raw [--capture-format NV12] [--capture-size 640x480]]
+*/
+
+const int DEFAULT_ITERATIONS = 20;
+const int CAPTURE_SLOTS = 8;            //same ring size as captureImages
+const int CAPTURE_FRAMES = 40;          //enough to cycle every buffer and wrap a short file
+
+//heap allocations, counted by interposing malloc (covers operator new and cv::fastMalloc)
+static volatile long allocations = 0;
+
+#ifdef __GLIBC__
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size)
+{
+    __sync_fetch_and_add(&allocations, 1);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+    __sync_fetch_and_add(&allocations, 1);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    __sync_fetch_and_add(&allocations, 1);
+    return __libc_realloc(ptr, size);
+}
+}
+#endif
+
+static long allocationCount()
+{
+    return __sync_fetch_and_add(&allocations, 0);
+}
+
+// Latency samples of one stage.
+struct stageTimes
+{
+    string name;
+    vector<double> ms;
+    long allocations;
+
+    explicit stageTimes(const string &name) : name(name), allocations(0) {}
+};
+
+// Times one call of a stage, construct before the call and stop() after it.
+class stageTimer
+{
+public:
+    explicit stageTimer(stageTimes &stage) : stage(stage)
+    {
+        allocStart = allocationCount();
+        timer.start();
+    }
+
+    double stop()
+    {
+        double ms = timer.nsecsElapsed() / 1000000.0;
+        stage.allocations += allocationCount() - allocStart;
+        stage.ms.push_back(ms);
+        return ms;
+    }
+
+private:
+    stageTimes &stage;
+    QElapsedTimer timer;
+    long allocStart;
+};
+
+static double percentile(vector<double> samples, double p)
+{
+    if (samples.empty()){
+        return 0;
+    }
+    sort(samples.begin(), samples.end());
+    size_t index = (size_t)(p / 100.0 * (samples.size() - 1) + 0.5);
+    return samples[index];
+}
+
+static double mean(const vector<double> &samples)
+{
+    double sum = 0;
+    for (size_t i = 0; i < samples.size(); i++){
+        sum += samples[i];
+    }
+    return samples.empty() ? 0 : sum / samples.size();
+}
+
+static const char *architecture()
+{
+#if defined(__aarch64__)
+    return "aarch64";
+#elif defined(__arm__)
+    return "arm";
+#elif defined(__x86_64__)
+    return "x86_64";
+#elif defined(__i386__)
+    return "x86";
+#else
+    return "unknown";
+#endif
+}
+
+static const char *simd()
+{
+#if defined(__SSE2__)
+    return "sse2";
+#elif defined(__ARM_NEON__)
+    return "neon";
+#else
+    return "none";
+#endif
+}
+
+/*
+  loads every image in a directory
+  @params - dir; flags(imread flags); images(out)
+*/
+static void loadImages(const string &dir, int flags, vector<Mat> &images)
+{
+    QDir imageDir(QString::fromStdString(dir));
+    QStringList files = imageDir.entryList(QStringList() << "*.png" << "*.jpg", QDir::Files, QDir::Name);
+    for (int i = 0; i < files.size(); i++){
+        string path = imageDir.filePath(files[i]).toStdString();
+        Mat image;
+        try{
+            image = imread(path, flags);
+        }catch(cv::Exception &e){}
+        if (image.empty()){
+            cout << "Could not load: " << path << endl;
+            continue;
+        }
+        images.push_back(image);
+    }
+}
+
+static void printStage(const stageTimes &stage)
+{
+    double calls = stage.ms.size();
+    printf("%-34s %6d %9.3f %9.3f %9.3f %9.3f %9.3f %9.1f\n", stage.name.c_str(), (int)stage.ms.size(),
+           mean(stage.ms), percentile(stage.ms, 50), percentile(stage.ms, 90), percentile(stage.ms, 99),
+           percentile(stage.ms, 100), calls > 0 ? stage.allocations / calls : 0.0);
+}
+
+/*
+  runs each facefilters kernel and the OpenCV call it replaces on every face, timing both
+  the warps are small rotations and scales about the face centre, as the eye alignment makes
+  @params - faces(all one size); iterations; stages(out, timings appended)
+  @returns - number of kernels differing from OpenCV by more than FACE_FILTER_TOLERANCE
+*/
+static int compareFaceFilters(const vector<Mat> &faces, int iterations, vector<stageTimes> &stages)
+{
+    stageTimes warpStage("warpAffine");
+    stageTimes warpFaceStage("warpFace");
+    stageTimes equalizeStage("equalizeHist");
+    stageTimes equalizeFaceStage("equalizeFace");
+    stageTimes filterStage("bilateralFilter");
+    stageTimes filterFaceStage("bilateralFace");
+    stageTimes maskStage("copyTo(mask)");
+    stageTimes maskFaceStage("maskFace");
+    double warpDiff = 0;
+    double equalizeDiff = 0;
+    double filterDiff = 0;
+    double maskDiff = 0;
+
+    preprocessWorkspace workspace;
+    workspace.prepare(faces[0].cols);
+    Mat expected(faces[0].size(), CV_8U);
+    Mat actual(faces[0].size(), CV_8U);
+    for (int it = 0; it < iterations; it++){
+        for (size_t i = 0; i < faces.size(); i++){
+            const Mat &face = faces[i];
+            int variant = (int)((it + i) % 9);
+            Point2f centre(face.cols * 0.5f, face.rows * 0.5f);
+            Mat transform = getRotationMatrix2D(centre, (variant - 4) * 2.5, 0.9 + 0.025 * variant);
+
+            stageTimer warpTimer(warpStage);
+            warpAffine(face, expected, transform, expected.size());
+            warpTimer.stop();
+            stageTimer warpFaceTimer(warpFaceStage);
+            warpFace(face, actual, transform);
+            warpFaceTimer.stop();
+            warpDiff = max(warpDiff, norm(expected, actual, NORM_INF));
+
+            stageTimer equalizeTimer(equalizeStage);
+            equalizeHist(face, expected);
+            equalizeTimer.stop();
+            stageTimer equalizeFaceTimer(equalizeFaceStage);
+            equalizeFace(face, actual);
+            equalizeFaceTimer.stop();
+            equalizeDiff = max(equalizeDiff, norm(expected, actual, NORM_INF));
+
+            stageTimer filterTimer(filterStage);
+            bilateralFilter(face, expected, 0, 20.0, 20.0);
+            filterTimer.stop();
+            stageTimer filterFaceTimer(filterFaceStage);
+            bilateralFace(face, actual, workspace.padded, workspace.bilateral, 20.0, 20.0);
+            filterFaceTimer.stop();
+            filterDiff = max(filterDiff, norm(expected, actual, NORM_INF));
+
+            stageTimer maskTimer(maskStage);
+            expected.setTo(Scalar(128));
+            face.copyTo(expected, workspace.mask);
+            maskTimer.stop();
+            stageTimer maskFaceTimer(maskFaceStage);
+            maskFace(face, workspace.mask, 128, actual);
+            maskFaceTimer.stop();
+            maskDiff = max(maskDiff, norm(expected, actual, NORM_INF));
+        }
+    }
+
+    printf("facefilters against OpenCV, %d faces, tolerance %d\n", (int)faces.size(), FACE_FILTER_TOLERANCE);
+    printf("  warpFace max difference %.0f\n", warpDiff);
+    printf("  equalizeFace max difference %.0f\n", equalizeDiff);
+    printf("  bilateralFace max difference %.0f\n", filterDiff);
+    printf("  maskFace max difference %.0f\n", maskDiff);
+
+    stages.push_back(warpStage);
+    stages.push_back(warpFaceStage);
+    stages.push_back(equalizeStage);
+    stages.push_back(equalizeFaceStage);
+    stages.push_back(filterStage);
+    stages.push_back(filterFaceStage);
+    stages.push_back(maskStage);
+    stages.push_back(maskFaceStage);
+    return (warpDiff > FACE_FILTER_TOLERANCE) + (equalizeDiff > FACE_FILTER_TOLERANCE) +
+           (filterDiff > FACE_FILTER_TOLERANCE) + (maskDiff > FACE_FILTER_TOLERANCE);
+}
+
+/*
+  checks equalizeLeftAndRightHalves against the per pixel reference on every face at FACE_WIDTH,
+  which goes through fixedFace<FACE_WIDTH>::blend, and at odd widths either side, which go through
+  blendRow and its scalar tail. Both equalise with equalizeHist so only the blend is compared
+  @params - detection; faces
+  @returns - 1 if any face differs by more than FACE_FILTER_TOLERANCE, else 0
+*/
+static int compareEqualize(detectObject &detection, const vector<Mat> &faces)
+{
+    const int widths[] = {FACE_WIDTH, FACE_WIDTH - 1, FACE_WIDTH + 1};
+    bool fastPreprocess = detection.fastPreprocess;
+    detection.fastPreprocess = false;
+    preprocessWorkspace workspace;
+    double diffs[3] = {0, 0, 0};
+    for (int w = 0; w < 3; w++){
+        for (size_t i = 0; i < faces.size(); i++){
+            Mat expected;
+            resize(faces[i], expected, Size(widths[w], widths[w]));
+            Mat actual = expected.clone();
+            detection.equalizeLeftAndRightHalvesReference(expected);
+            detection.equalizeLeftAndRightHalves(actual, workspace);
+            diffs[w] = max(diffs[w], norm(expected, actual, NORM_INF));
+        }
+    }
+    detection.fastPreprocess = fastPreprocess;
+
+    printf("equalizeLeftAndRightHalves against the reference, %d faces, tolerance %d\n", (int)faces.size(),
+           FACE_FILTER_TOLERANCE);
+    printf("  %dx%d (fixedFace) max difference %.0f\n", widths[0], widths[0], diffs[0]);
+    printf("  %dx%d (blendRow) max difference %.0f\n", widths[1], widths[1], diffs[1]);
+    printf("  %dx%d (blendRow) max difference %.0f\n", widths[2], widths[2], diffs[2]);
+    return (diffs[0] > FACE_FILTER_TOLERANCE || diffs[1] > FACE_FILTER_TOLERANCE || diffs[2] > FACE_FILTER_TOLERANCE) ? 1 : 0;
+}
+
+/*
+  reads frames through v4l2Camera's stand-in as the capture thread does, each ring slot holding
+  its buffer until it is written again, and compares every grey frame with the luma read
+  straight from the file. The preview must come out BGR at the same size
+  @params - path; format; width, height
+  @returns - frames that differed or failed, -1 if the file can't be opened
+*/
+static int checkCapture(const string &path, const string &format, int width, int height)
+{
+    v4l2Camera camera;
+    if (!camera.openFile(path, format, width, height, CAPTURE_SLOTS, 0)){
+        return -1;
+    }
+    bool packed = format == "YUYV";
+    size_t frameBytes = (size_t)width * height * (packed ? 2 : 1);
+    if (format == "NV12" || format == "YU12"){
+        frameBytes = frameBytes * 3 / 2;
+    }
+    FILE *raw = fopen(path.c_str(), "rb");
+    if (raw == NULL){
+        return -1;
+    }
+    fseek(raw, 0, SEEK_END);
+    long frameCount = ftell(raw) / (long)frameBytes;
+
+    vector<Mat> ring(CAPTURE_SLOTS);
+    vector<uchar> expected(frameBytes);
+    int failures = 0;
+    for (int i = 0; i < CAPTURE_FRAMES; i++){
+        int slot = i % CAPTURE_SLOTS;
+        Mat &grey = ring[slot];
+        fseek(raw, (long)(i % frameCount) * (long)frameBytes, SEEK_SET);
+        if (!camera.read(slot, grey) || fread(&expected[0], 1, frameBytes, raw) != frameBytes ||
+                grey.rows != height || grey.cols != width || grey.type() != CV_8U){
+            failures++;
+            continue;
+        }
+        bool same = true;
+        for (int y = 0; y < height && same; y++){
+            const uchar *row = grey.ptr<uchar>(y);
+            for (int x = 0; x < width; x++){
+                uchar luma = packed ? expected[(y * width + x) * 2] : expected[y * width + x];
+                if (row[x] != luma){
+                    same = false;
+                    break;
+                }
+            }
+        }
+        Mat preview;
+        camera.colour(slot, grey, preview);
+        if (!same || preview.type() != CV_8UC3 || preview.size() != grey.size()){
+            failures++;
+        }
+    }
+    fclose(raw);
+    printf("capture: %d frames of %s %dx%d, %d failed\n", CAPTURE_FRAMES, format.c_str(), width, height, failures);
+    return failures;
+}
+
+static bool writeJson(const string &filename, const vector<stageTimes> &stages, double throughput, int iterations)
+{
+    FILE *file = fopen(filename.c_str(), "w");
+    if (file == NULL){
+        fprintf(stderr, "Could not write: %s\n", filename.c_str());
+        return false;
+    }
+    fprintf(file, "{\n  \"arch\": \"%s\",\n  \"simd\": \"%s\",\n  \"iterations\": %d,\n", architecture(), simd(), iterations);
+    fprintf(file, "  \"throughput_fps\": %.3f,\n  \"stages\": [\n", throughput);
+    for (size_t i = 0; i < stages.size(); i++){
+        const stageTimes &stage = stages[i];
+        double calls = stage.ms.size();
+        fprintf(file, "    {\"name\": \"%s\", \"calls\": %d, \"mean_ms\": %.4f, \"p50_ms\": %.4f, \"p90_ms\": %.4f, "
+                      "\"p99_ms\": %.4f, \"max_ms\": %.4f, \"allocs_per_call\": %.2f}%s\n",
+                stage.name.c_str(), (int)stage.ms.size(), mean(stage.ms), percentile(stage.ms, 50),
+                percentile(stage.ms, 90), percentile(stage.ms, 99), percentile(stage.ms, 100),
+                calls > 0 ? stage.allocations / calls : 0.0, i + 1 < stages.size() ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    fclose(file);
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    string facesDir = "faces/";
+    string processedDir = "ProcessedFaces/";
+    string output = "benchmark.json";
+    int iterations = DEFAULT_ITERATIONS;
+    int fastPreprocess = -1;    //-1 keeps the build's default
+    bool verify = false;
+    string captureFile;
+    string captureFormat = "NV12";
+    int captureWidth = 640;
+    int captureHeight = 480;
+    for (int i = 1; i < argc; i += 2){
+        if (strcmp(argv[i], "--verify") == 0){
+            verify = true;
+            i--;
+        }else if (i + 1 >= argc){
+            cout << "Missing value for " << argv[i] << endl;
+            return -1;
+        }else if (strcmp(argv[i], "--faces") == 0){
+            facesDir = argv[i + 1];
+        }else if (strcmp(argv[i], "--processed") == 0){
+            processedDir = argv[i + 1];
+        }else if (strcmp(argv[i], "--iterations") == 0){
+            iterations = max(1, atoi(argv[i + 1]));
+        }else if (strcmp(argv[i], "--output") == 0){
+            output = argv[i + 1];
+        }else if (strcmp(argv[i], "--fast-preprocess") == 0){
+            fastPreprocess = atoi(argv[i + 1]) != 0;
+        }else if (strcmp(argv[i], "--capture") == 0){
+            captureFile = argv[i + 1];
+        }else if (strcmp(argv[i], "--capture-format") == 0){
+            captureFormat = argv[i + 1];
+        }else if (strcmp(argv[i], "--capture-size") == 0){
+            if (sscanf(argv[i + 1], "%dx%d", &captureWidth, &captureHeight) != 2){
+                cout << "Bad capture size: " << argv[i + 1] << endl;
+                return -1;
+            }
+        }else{
+            cout << "Usage: benchmark [--faces dir] [--processed dir] [--iterations n] [--output file.json]"
+                    " [--fast-preprocess 0|1] [--verify]"
+                    " [--capture file.raw [--capture-format NV12] [--capture-size 640x480]]" << endl;
+            return -1;
+        }
+    }
+
+    if (!captureFile.empty()){
+        //no cascades or faces needed
+        int failures = checkCapture(captureFile, captureFormat, captureWidth, captureHeight);
+        return failures == 0 ? 0 : 1;
+    }
+
+    detectObject detection;
+    recognition faceRecognition;
+    CascadeClassifier faceCascade;
+    CascadeClassifier eyeCascade;
+    CascadeClassifier eyeGlassCascade;
+    if (fastPreprocess >= 0){
+        detection.fastPreprocess = fastPreprocess != 0;
+    }
+    detection.initCascades(faceCascade, eyeCascade, eyeGlassCascade);
+    if (faceCascade.empty() || eyeCascade.empty() || eyeGlassCascade.empty()){
+        return -1;
+    }
+
+    vector<Mat> frames;
+    vector<Mat> faces;
+    loadImages(facesDir, 1, frames);
+    loadImages(processedDir, 0, faces);
+    cout << "frames: " << frames.size() << " processed faces: " << faces.size() << endl;
+
+    vector<stageTimes> stages;
+    stageTimes processStage("processImage");
+    stageTimes equalizeStage("equalizeLeftAndRightHalves");
+    stageTimes equalizeRefStage("equalizeLeftAndRightHalvesReference");
+    stageTimes learnStage("learnCollectedFaces");
+    stageTimes updateStage("updateCollectedFaces");
+    stageTimes reconstructStage("reconstructFace");
+    stageTimes similarityStage("getSimilarity");
+    stageTimes residualStage("reconstructionSimilarity");
+    stageTimes batchStage("recogniseBatch");
+    stageTimes predictStage("predict");
+
+    //camera frames through detection and preprocessing, faces found on the first pass join the training set
+    //--verify only needs the preprocessed faces
+    preprocessWorkspace workspace;
+    size_t galleryFaces = faces.size();
+    for (int it = 0; it < (verify ? 0 : iterations); it++){
+        for (size_t i = 0; i < frames.size(); i++){
+            stageTimer timer(processStage);
+            Mat face = detection.processImage(frames[i], faceCascade, eyeCascade, eyeGlassCascade, workspace);
+            timer.stop();
+            if (it == 0 && !face.empty()){
+                faces.push_back(face.clone());
+            }
+        }
+    }
+    cout << "faces found in frames: " << faces.size() - galleryFaces << endl;
+    if (faces.size() < 2){
+        cout << "Need at least 2 faces to train, add images to " << processedDir << endl;
+        return -1;
+    }
+    cout << "face preprocessing: " << (detection.fastPreprocess ? "facefilters" : "OpenCV") << endl;
+    //PCA needs equal sizes, keep faces matching the first
+    vector<Mat> trainingFaces;
+    vector<int> labels;
+    for (size_t i = 0; i < faces.size(); i++){
+        if (faces[i].size() == faces[0].size()){
+            trainingFaces.push_back(faces[i]);
+            labels.push_back((int)i);
+        }
+    }
+
+    vector<stageTimes> filterStages;
+    int filterFailures = compareFaceFilters(trainingFaces, iterations, filterStages);
+    int equalizeFailures = compareEqualize(detection, trainingFaces);
+    if (verify){
+        printf("%s\n", filterFailures == 0 ? "facefilters match OpenCV" : "facefilters differ from OpenCV");
+        printf("%s\n", equalizeFailures == 0 ? "equalizeLeftAndRightHalves matches the reference"
+                                             : "equalizeLeftAndRightHalves differs from the reference");
+        return filterFailures + equalizeFailures == 0 ? 0 : 1;
+    }
+
+    for (int it = 0; it < iterations; it++){
+        for (size_t i = 0; i < trainingFaces.size(); i++){
+            Mat face = trainingFaces[i].clone();
+            stageTimer timer(equalizeStage);
+            detection.equalizeLeftAndRightHalves(face, workspace);
+            timer.stop();
+
+            face = trainingFaces[i].clone();
+            stageTimer refTimer(equalizeRefStage);
+            detection.equalizeLeftAndRightHalvesReference(face);
+            refTimer.stop();
+        }
+    }
+
+    for (int it = 0; it < iterations; it++){
+        stageTimer timer(learnStage);
+        faceRecognition.learnCollectedFaces(trainingFaces, labels);
+        timer.stop();
+    }
+
+    //fold each face back in once, as the capture loop does on a match
+    for (size_t i = 0; i < trainingFaces.size(); i++){
+        vector<Mat> newFaces(1, trainingFaces[i]);
+        vector<int> newLabels(1, labels[i]);
+        stageTimer timer(updateStage);
+        faceRecognition.updateCollectedFaces(newFaces, newLabels);
+        timer.stop();
+    }
+    faceRecognition.learnCollectedFaces(trainingFaces, labels);
+
+    //fused path should agree with the image path up to its 8-bit rounding
+    Mat coefficients;
+    double residualError = 0;
+    for (int it = 0; it < iterations; it++){
+        for (size_t i = 0; i < trainingFaces.size(); i++){
+            stageTimer timer(reconstructStage);
+            Mat reconstructedFace = faceRecognition.reconstructFace(trainingFaces[i]);
+            timer.stop();
+
+            stageTimer similarityTimer(similarityStage);
+            double similarity = faceRecognition.getSimilarity(trainingFaces[i], reconstructedFace);
+            similarityTimer.stop();
+
+            stageTimer residualTimer(residualStage);
+            double residual = faceRecognition.reconstructionSimilarity(trainingFaces[i], &coefficients);
+            residualTimer.stop();
+            residualError = max(residualError, fabs(residual - similarity));
+        }
+    }
+
+    //a whole window of faces in one call, against one call per face
+    vector<double> similarities;
+    vector<int> batchLabels;
+    int labelMismatches = 0;
+    for (int it = 0; it < iterations; it++){
+        stageTimer timer(batchStage);
+        faceRecognition.recogniseBatch(trainingFaces, similarities, batchLabels);
+        timer.stop();
+        for (size_t i = 0; i < trainingFaces.size(); i++){
+            stageTimer predictTimer(predictStage);
+            int label = faceRecognition.predict(trainingFaces[i]);
+            predictTimer.stop();
+            labelMismatches += (it == 0 && label != batchLabels[i]);
+        }
+    }
+
+    stages.push_back(processStage);
+    stages.push_back(equalizeStage);
+    stages.push_back(equalizeRefStage);
+    stages.push_back(learnStage);
+    stages.push_back(updateStage);
+    stages.push_back(reconstructStage);
+    stages.push_back(similarityStage);
+    stages.push_back(residualStage);
+    stages.push_back(batchStage);
+    stages.push_back(predictStage);
+    stages.insert(stages.end(), filterStages.begin(), filterStages.end());
+
+    //frames per second through detection and the fused similarity the pipeline uses, one thread
+    double perFrame = mean(processStage.ms) + mean(residualStage.ms);
+    double throughput = perFrame > 0 ? 1000.0 / perFrame : 0;
+
+    printf("\n%s %s, %d iterations\n", architecture(), simd(), iterations);
+    printf("%-34s %6s %9s %9s %9s %9s %9s %9s\n", "stage", "calls", "mean ms", "p50 ms", "p90 ms", "p99 ms", "max ms", "allocs");
+    for (size_t i = 0; i < stages.size(); i++){
+        printStage(stages[i]);
+    }
+    printf("throughput: %.1f frames/s\n", throughput);
+    printf("reconstructionSimilarity max difference from getSimilarity: %.6f\n", residualError);
+    printf("recogniseBatch: %d faces per call, %.3f ms per face, %d labels differ from predict\n",
+           (int)trainingFaces.size(), mean(batchStage.ms) / trainingFaces.size(), labelMismatches);
+
+    return writeJson(output, stages, throughput, iterations) ? 0 : -1;
+}
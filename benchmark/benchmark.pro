@@ -0,0 +1,38 @@
+#-------------------------------------------------
+#
+# Offline benchmark of the recognition pipeline stages
+# build: cd benchmark && qmake && make
+# run from the project directory so faces/ and ProcessedFaces/ are found
+# the IMX6 build's NEON kernels can be checked on a PC: build with the linux-mxc-g++ spec and
+# run "qemu-arm -L <target rootfs> benchmark/benchmark --verify"
+#
+#-------------------------------------------------
+
+QT       += core
+QT       -= gui
+
+TARGET = benchmark
+TEMPLATE = app
+CONFIG   += console
+
+include(../opencv.pri)
+
+INCLUDEPATH += ..
+DEPENDPATH += ..
+
+SOURCES += benchmark.cpp \
+    ../detectobject.cpp \
+    ../facefilters.cpp \
+    ../recognition.cpp \
+    ../simdkernels.cpp \
+    ../stats.cpp \
+    ../v4l2camera.cpp
+
+HEADERS  += \
+    ../detectobject.h \
+    ../facefilters.h \
+    ../fixedface.h \
+    ../recognition.h \
+    ../simdkernels.h \
+    ../stats.h \
+    ../v4l2camera.h
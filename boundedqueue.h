@@ -0,0 +1,94 @@
+#ifndef BOUNDEDQUEUE_H
+#define BOUNDEDQUEUE_H
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <QWaitCondition>
+
+#include <deque>
+#include <climits>
+
+// Fixed capacity FIFO between pipeline stages, producers block (or give up) when it is full.
+template <typename T>
+class boundedQueue
+{
+public:
+    explicit boundedQueue(int capacity) : capacity(capacity), closed(false) {}
+
+    // false if the queue is full or closed, never blocks
+    bool tryPush(const T &item)
+    {
+        QMutexLocker locker(&lock);
+        if (closed || (int)items.size() >= capacity){
+            return false;
+        }
+        items.push_back(item);
+        notEmpty.wakeOne();
+        return true;
+    }
+
+    // blocks while the queue is full, false if it was closed
+    bool push(const T &item)
+    {
+        QMutexLocker locker(&lock);
+        while (!closed && (int)items.size() >= capacity){
+            notFull.wait(&lock);
+        }
+        if (closed){
+            return false;
+        }
+        items.push_back(item);
+        notEmpty.wakeOne();
+        return true;
+    }
+
+    // waits up to timeout ms (-1 = forever) for an item, false on timeout or once closed and drained
+    bool pop(T &item, int timeout = -1)
+    {
+        QMutexLocker locker(&lock);
+        while (items.empty() && !closed){
+            if (!notEmpty.wait(&lock, timeout < 0 ? ULONG_MAX : (unsigned long)timeout)){
+                return false;
+            }
+        }
+        if (items.empty()){
+            return false;
+        }
+        item = items.front();
+        items.pop_front();
+        notFull.wakeOne();
+        return true;
+    }
+
+    // wakes every waiting thread, pushes fail from now on
+    void close()
+    {
+        QMutexLocker locker(&lock);
+        closed = true;
+        notEmpty.wakeAll();
+        notFull.wakeAll();
+    }
+
+    void reopen()
+    {
+        QMutexLocker locker(&lock);
+        closed = false;
+        items.clear();
+    }
+
+    int size()
+    {
+        QMutexLocker locker(&lock);
+        return (int)items.size();
+    }
+
+private:
+    QMutex lock;
+    QWaitCondition notEmpty;
+    QWaitCondition notFull;
+    std::deque<T> items;
+    int capacity;
+    bool closed;
+};
+
+#endif // BOUNDEDQUEUE_H
@@ -1,7 +1,8 @@
 #include "captureimages.h"
+#include "stats.h"
 
-#include <QTimer>
 #include <QtCore>
+#include <QMutexLocker>
 #include <iostream>
 #include<stdio.h>
 
@@ -14,44 +15,175 @@
 using namespace std;
 using namespace cv;
 
-VideoCapture cap;
-vector<Mat>faces;
+const int RING_SLOTS = 8;
+const int RETRY_DELAY = 10;     //ms to wait after a failed grab
+const int MOTION_HOLD = 3000;   //ms the scene stays active after the last motion
+const int RATE_INTERVAL = 2000; //ms the capture rate is averaged over
 
+captureImages::captureImages() : frames(RING_SLOTS)
+{
+    count = 0;
+    done = 0;
+    stopping = 0;
+    interval = 0;
+    duration = 0;
+    windowActive = false;
+    active = 0;
+    camera = 0;
+    rateFrames = 0;
+    native = false;
+}
+
+captureImages::~captureImages()
+{
+    stopCapture();
+}
+
+/*
+  starts the capture thread, which becomes the only reader of the camera
+  @params - capture(opened camera); camera(index for the stats report)
+*/
+void captureImages::startCapture(VideoCapture &capture, int camera)
+{
+    if (isRunning()){
+        return;
+    }
+    cap = capture;
+    native = false;
+    this->camera = camera;
+    rateFrames = 0;
+    rateTimer.start();
+    stopping = 0;
+    start();
+}
+
+/*
+  starts the capture thread on the camera's own buffers, frames come out grey and are read in place
+  @params - device(video device number); width, height; camera(index for the stats report)
+  @returns - false if the device has no luma format or can't stream, nothing is started
+*/
+bool captureImages::startCapture(int device, int width, int height, int camera)
+{
+    if (isRunning()){
+        return false;
+    }
+    if (!this->device.open(device, width, height, RING_SLOTS)){
+        return false;
+    }
+    native = true;
+    this->camera = camera;
+    rateFrames = 0;
+    rateTimer.start();
+    stopping = 0;
+    start();
+    return true;
+}
 
-captureImages::captureImages()
+void captureImages::stopCapture()
 {
-    timer = new QTimer(this);
-    connect(timer, SIGNAL(timeout()), this, SLOT(captureImage()));
+    stopping = 1;
+    wait();
+    device.release();
 }
 
-void captureImages::startTimer(int interval,int duration,  VideoCapture& capture, vector<Mat>& userFaces, bool ret)
+/*
+  @params - slot, frame(pinned by the caller); preview(out, header onto frame unless it had to be converted)
+*/
+void captureImages::previewImage(int slot, const Mat &frame, Mat &preview)
 {
-    if (!ret){
-        count = 0;
-        done = false;
-        cap = capture;
-        faces= userFaces;
-        timer->start(interval);
-        QTimer::singleShot(duration, this, SLOT(endTimer()));
+    if (native){
+        device.colour(slot, frame, preview);
     }else{
-        userFaces = faces;
+        preview = frame;
     }
 }
 
-void captureImages::captureImage()
+/*
+  capture loop, grabs into a free ring slot at camera rate
+  if every slot is pinned by readers the frame is grabbed and discarded
+  so the driver queue doesn't back up. Each frame is checked for motion
+  before it is published
+*/
+void captureImages::run()
 {
-    count++;
-    Mat face;
-    cap >> face;
-    faces.push_back(face);
+    while (!stopping){
+        int slot = frames.beginWrite();
+        if (slot < 0){
+            if (native){
+                device.skip();
+            }else{
+                cap.grab();
+            }
+            continue;
+        }
+        bool ok = false;
+        if (native){
+            ok = device.read(slot, frames.slotImage(slot));
+        }else{
+            try{
+                ok = cap.read(frames.slotImage(slot)) && !frames.slotImage(slot).empty();
+            }catch(cv::Exception &e){}
+        }
+        if (ok && motion.update(frames.slotImage(slot))){
+            sinceMotion.start();
+        }
+        active = sinceMotion.isValid() && sinceMotion.elapsed() < MOTION_HOLD;
+        frames.endWrite(slot, ok);
+        if (!ok){
+            msleep(RETRY_DELAY);
+            continue;
+        }
+        rateFrames++;
+        if (rateTimer.elapsed() >= RATE_INTERVAL){
+            stageStats.setFrameRate(camera, rateFrames * 1000.0 / rateTimer.elapsed());
+            rateFrames = 0;
+            rateTimer.restart();
+        }
+        tickWindow();
+    }
+}
+
+void captureImages::startTimer(int interval,int duration)
+{
+    QMutexLocker lock(&windowLock);
+    count = 0;
+    done = 0;
+    this->interval = interval;
+    this->duration = duration;
+    window.start();
+    windowActive = true;
+}
+
+/*
+  advances the capture window, one count per interval, done once duration has passed
+*/
+void captureImages::tickWindow()
+{
+    QMutexLocker lock(&windowLock);
+    if (!windowActive){
+        return;
+    }
+    qint64 elapsed = window.elapsed();
+    if (elapsed >= duration){
+        windowActive = false;
+        done = 1;
+        cout << "timer stopped" << endl;
+    }else if (elapsed >= (qint64)(count + 1) * interval){
+        count.fetchAndAddOrdered(1);
+    }
 }
 
 void captureImages::endTimer()
 {
-    if(timer->isActive()){
-        timer->stop();
-        done = true;
+    QMutexLocker lock(&windowLock);
+    if(windowActive){
+        windowActive = false;
+        done = 1;
         cout << "timer stopped" << endl;
     }
 }
 
+bool captureImages::sceneActive()
+{
+    return active;
+}
@@ -2,7 +2,9 @@
 #define CAPTUREIMAGES_H
 
 #include<QtCore>
-#include <QTimer>
+#include <QThread>
+#include <QMutex>
+#include <QElapsedTimer>
 
 #include "opencv2/opencv.hpp"
 #include "opencv2/imgproc/imgproc.hpp"
@@ -10,24 +12,63 @@
 #include "opencv2/video/video.hpp"
 #include "opencv2/objdetect/objdetect.hpp"
 
+#include "framering.h"
+#include "motiondetector.h"
+#include "v4l2camera.h"
+
 using namespace std;
 using namespace cv;
 
-class captureImages : public QObject
+// Reads the camera on its own thread into a frameRing, times the capture window and watches for motion.
+class captureImages : public QThread
 {
     Q_OBJECT
 public:
     captureImages();
-    QTimer *timer;
-    void startTimer(int interval, int duration, VideoCapture &capture, vector<Mat>& userFaces, bool ret);
-    int count;
+    ~captureImages();
 
-    bool done;
+    // camera is the index the capture rate is reported under
+    void startCapture(VideoCapture &capture, int camera = 0);
+    // reads /dev/video<device> natively into grey frames, false if it can't and VideoCapture should be used
+    bool startCapture(int device, int width, int height, int camera = 0);
+    void stopCapture();
+    // what the stream window shows for a pinned frame, colour is only converted here for native capture
+    void previewImage(int slot, const Mat &frame, Mat &preview);
+    // open a capture window: count ticks every interval ms until duration ms have passed
+    void startTimer(int interval, int duration);
+    // true if the scene changed in the last MOTION_HOLD ms, detection can stay idle otherwise
+    bool sceneActive();
 
+    frameRing frames;
+    QAtomicInt count;
+    QAtomicInt done;
 
 public slots:
-    void captureImage();
     void endTimer();
+
+protected:
+    void run();
+
+private:
+    void tickWindow();
+
+    VideoCapture cap;
+    v4l2Camera device;
+    bool native;            // reading device rather than cap
+    QAtomicInt stopping;
+    int camera;
+    QElapsedTimer rateTimer;
+    int rateFrames;         // frames captured since rateTimer started
+
+    motionDetector motion;  // capture thread only
+    QElapsedTimer sinceMotion;
+    QAtomicInt active;
+
+    QMutex windowLock;      // window settings, written by the UI and read by the capture thread
+    QElapsedTimer window;
+    int interval;
+    int duration;
+    bool windowActive;
 };
 
 #endif // CAPTUREIMAGES_H
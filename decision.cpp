@@ -0,0 +1,60 @@
+#include "decision.h"
+
+#include <math.h>
+
+const double FRAME_LIMIT = 3.0;     //most evidence one frame can add, a single odd frame can't decide the window
+
+sequentialDecision::sequentialDecision(double falseAccept, double falseReject,
+                                       double genuineMean, double impostorMean, double sigma)
+    : genuineMean(genuineMean), impostorMean(impostorMean), sigma(sigma)
+{
+    upperBound = log((1.0 - falseReject) / falseAccept);
+    lowerBound = log(falseReject / (1.0 - falseAccept));
+    reset();
+}
+
+void sequentialDecision::reset()
+{
+    identities.clear();
+    total = 0;
+    leader = -1;
+    scored = 0;
+    decision = DECISION_PENDING;
+}
+
+/*
+  log likelihood ratio of the frame under the genuine and impostor score models, then
+  the identity and overall sums are checked against the bounds. Once decided the state holds until reset
+  @params - similarity(frame score); identity(label recognised in the frame)
+  @returns - DECISION_PENDING, DECISION_ACCEPT or DECISION_REJECT
+*/
+int sequentialDecision::add(double similarity, int identity)
+{
+    if (decision != DECISION_PENDING){
+        return decision;
+    }
+    double toImpostor = similarity - impostorMean;
+    double toGenuine = similarity - genuineMean;
+    double ratio = (toImpostor * toImpostor - toGenuine * toGenuine) / (2.0 * sigma * sigma);
+    if (ratio > FRAME_LIMIT){
+        ratio = FRAME_LIMIT;
+    }else if (ratio < -FRAME_LIMIT){
+        ratio = -FRAME_LIMIT;
+    }
+    scored++;
+    total += ratio;
+
+    double &forIdentity = identities[identity];
+    forIdentity += ratio;
+    if (leader < 0 || forIdentity > identities[leader]){
+        leader = identity;
+    }
+
+    if (identity >= 0 && forIdentity >= upperBound){
+        leader = identity;
+        decision = DECISION_ACCEPT;
+    }else if (total <= lowerBound){
+        decision = DECISION_REJECT;
+    }
+    return decision;
+}
@@ -0,0 +1,52 @@
+#ifndef DECISION_H
+#define DECISION_H
+
+#include <map>
+
+using namespace std;
+
+enum decisionState { DECISION_PENDING, DECISION_ACCEPT, DECISION_REJECT };
+
+/*
+  Wald's sequential probability ratio test over the similarity scores of a capture window.
+  Scores are modelled as normal, around genuineMean for the enrolled user and impostorMean for
+  anyone else, and every frame adds its log likelihood ratio to the evidence. The error rates only
+  hold as far as the model fits the deployment's scores: fit it from the similarity column of
+  --batch runs over images of enrolled users and of strangers. The window is
+  decided as soon as the evidence crosses the bounds set by the two error rates, so a clear
+  match or a clear stranger ends it after a few frames.
+  Accepting needs the evidence for one identity, rejecting the evidence over all frames.
+*/
+class sequentialDecision
+{
+public:
+    // falseAccept/falseReject are the target error rates of the test, the rest the score model
+    sequentialDecision(double falseAccept = 0.001, double falseReject = 0.01,
+                       double genuineMean = 0.45, double impostorMean = 0.85, double sigma = 0.12);
+
+    void reset();
+    // adds one scored frame, returns the decisionState after it
+    int add(double similarity, int identity);
+
+    int state() const { return decision; }
+    int identity() const { return leader; }
+    int frames() const { return scored; }
+    double evidence() const { return total; }
+
+    // score model, similarity is an L2 reconstruction error so genuine scores are the lower ones
+    // and genuineMean < impostorMean
+    double genuineMean;
+    double impostorMean;
+    double sigma;
+
+private:
+    double upperBound;          // log((1 - falseReject) / falseAccept)
+    double lowerBound;          // log(falseReject / (1 - falseAccept))
+    map<int, double> identities;    // evidence per identity
+    double total;
+    int leader;
+    int scored;
+    int decision;
+};
+
+#endif // DECISION_H
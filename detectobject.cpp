@@ -5,6 +5,14 @@
 #include "opencv2/highgui/highgui.hpp"
 #include "opencv2/objdetect/objdetect.hpp"
 
+#include "simdkernels.h"
+#include "fixedface.h"
+#include "stats.h"
+
+#include <QThread>
+#include <QFuture>
+#include <QtConcurrentRun>
+
 #include <stdio.h>
 #include <string>
 #include <iostream>
@@ -19,15 +27,416 @@ const char *faceCascadeFilename = "/home/standby/opencv/opencv-2.4.10/data/lbpca
 const char *eyeCascadeFilename1 = "/home/standby/opencv/opencv-2.4.10/data/haarcascades/haarcascade_eye.xml";               // Basic eye detector for open eyes only.
 const char *eyeCascadeFilename2 = "/home/standby/opencv/opencv-2.4.10/data/haarcascades/haarcascade_eye_tree_eyeglasses.xml"; // Basic eye detector for open eyes if they might wear glasses.
 
-const int faceWidth = 70;
+const int faceWidth = FACE_WIDTH;
 const double DESIRED_LEFT_EYE_X = 0.16;     // Controls how much of the face is visible after preprocessing.
 const double DESIRED_LEFT_EYE_Y = 0.14;
 const double FACE_ELLIPSE_CY = 0.40;
 const double FACE_ELLIPSE_W = 0.50;         // Should be atleast 0.5
 const double FACE_ELLIPSE_H = 0.80;         // Controls how tall the face mask is.
+const int TRACK_REFRESH = 10;               // frames between full frame searches while tracking
+const float TRACK_MARGIN = 0.5f;            // region searched around the last face, in face widths per side
+const int TRACK_FACE_SIZE = 40;             // tracked face is scaled to about this many pixels for the search
+const float TRACK_MIN_SCALE = 0.7f;         // face size change allowed between frames
+const float TRACK_MAX_SCALE = 1.4f;
+const double PYRAMID_FACTOR = 1.1;          // scale between pyramid levels, the cascade scale step findObject always used
+const int PYRAMID_MIN_SIZE = 20;            // levels stop once the frame is smaller than this, no cascade window fits
+const int PYRAMID_NEIGHBOURS = 4;           // same detection filter as findObject
+const double PYRAMID_GROUP_EPS = 0.2;       // detectMultiScale's grouping tolerance
+const int FACE_MIN_SIZE = 20;               // smallest face searched for in the scaled frame
+const double SCHEDULE_SMOOTHING = 0.2;      // weight of the newest frame in the smoothed latency
+const int SCHEDULE_HOLD = 4;                // frames at a level before it changes again, the average has to catch up
+const double SCHEDULE_HEADROOM = 0.6;       // steps back up once the latency is below this fraction of the budget
+
+// One step of the scheduler, from the full quality search down.
+struct scheduleLevel
+{
+    int scaledWidth;
+    int levelStep;
+    float minFaceScale;     // full frame searches skip faces smaller than this times the last face seen
+    int trackFaceSize;
+};
+
+const scheduleLevel SCHEDULE[] = {
+    {320, 1, 0.0f, TRACK_FACE_SIZE},
+    {320, 2, 0.0f, TRACK_FACE_SIZE},
+    {256, 2, 0.5f, 32},
+    {200, 2, 0.6f, 28},
+    {160, 3, 0.7f, 24},     // the LBP face cascade's window
+};
+const int SCHEDULE_LEVELS = sizeof(SCHEDULE) / sizeof(SCHEDULE[0]);
+
+typedef fixedFace<faceWidth> defaultFace;   // preprocessing specialised for the default face size
+
+preprocessWorkspace::preprocessWorkspace()
+{
+    faceWidth = 0;
+    nextGrey = 0;
+    nextFace = 0;
+    nextPyramid = 0;
+    concurrentEyes = true;
+    eyeCascadesTried = false;
+    rotation = Mat(2, 3, CV_64F);
+    prepare(::faceWidth);
+}
+
+/*
+  sets up everything that only depends on the output face size
+  @params - width (output face width & height)
+*/
+void preprocessWorkspace::prepare(int width)
+{
+    if (width == faceWidth){
+        return;
+    }
+    faceWidth = width;
+    int desiredFaceHeight = width;
+
+    //filter out corners of face to focus on middle parts, the default size shares the static mask
+    if (width == ::faceWidth){
+        mask = defaultFace::mask();
+    }else{
+        mask = Mat(desiredFaceHeight, width, CV_8U);
+        drawFaceMask(mask);
+    }
+
+    blendWeights.resize(width);
+    halvesBlendWeights(width, &blendWeights[0]);
+
+    warped.create(desiredFaceHeight, width, CV_8U);
+    filtered.create(desiredFaceHeight, width, CV_8U);
+    wholeFace.create(desiredFaceHeight, width, CV_8U);
+}
+
+/*
+  ellipse that keeps the middle of the face, for the workspaces and the fixedFace tables
+  @params - mask(square CV_8U image, overwritten)
+*/
+void drawFaceMask(Mat &mask)
+{
+    int width = mask.cols;
+    int height = mask.rows;
+    mask.setTo(Scalar(0));  //start with empty mask
+    Point faceCenter = Point(width/2, cvRound(height * FACE_ELLIPSE_CY));
+    Size size = Size(cvRound(width * FACE_ELLIPSE_W), cvRound(height * FACE_ELLIPSE_H));
+    ellipse(mask, faceCenter, size, 0, 0, 360, Scalar(255), CV_FILLED);
+}
+
+/*
+  as pooled(), the pooled pyramids let go of their frames first: a frame handed downstream is
+  held by the item's own grey and pyramid copies, so only those keep its buffer from reuse
+*/
+Mat &preprocessWorkspace::greyBuffer()
+{
+    for (int i = 0; i < WORKSPACE_POOL; i++){
+        pyramidPool[i].releaseSource();
+    }
+    return pooled(greyPool, nextGrey);
+}
+
+Mat &preprocessWorkspace::faceBuffer()
+{
+    return pooled(facePool, nextFace);
+}
+
+/*
+  as pooled(), a pyramid whose levels are still held by a pipeline item is skipped
+  or, if every one is held, released so reset() fills new buffers
+*/
+framePyramid &preprocessWorkspace::pyramidBuffer()
+{
+    for (int i = 0; i < WORKSPACE_POOL; i++){
+        framePyramid &pyramid = pyramidPool[(nextPyramid + i) % WORKSPACE_POOL];
+        if (!pyramid.shared()){
+            nextPyramid = (nextPyramid + i + 1) % WORKSPACE_POOL;
+            return pyramid;
+        }
+    }
+    framePyramid &pyramid = pyramidPool[nextPyramid];
+    pyramid.release();
+    nextPyramid = (nextPyramid + 1) % WORKSPACE_POOL;
+    return pyramid;
+}
+
+/*
+  round robin over the pool, skipping buffers whose data is still referenced downstream
+  (e.g. a face waiting in a pipeline queue). If every buffer is held one is detached,
+  the holder keeps its copy and the next create() allocates a fresh one
+  @params - pool; next(round robin position)
+  @returns - buffer that is safe to overwrite
+*/
+Mat &preprocessWorkspace::pooled(Mat *pool, int &next)
+{
+    for (int i = 0; i < WORKSPACE_POOL; i++){
+        Mat &buffer = pool[(next + i) % WORKSPACE_POOL];
+        //read atomically, other pipeline threads drop their references with CV_XADD
+        if (buffer.refcount == NULL || CV_XADD(buffer.refcount, 0) == 1){
+            next = (next + i + 1) % WORKSPACE_POOL;
+            return buffer;
+        }
+    }
+    Mat &buffer = pool[next];
+    buffer.release();
+    next = (next + 1) % WORKSPACE_POOL;
+    return buffer;
+}
+
+framePyramid::framePyramid()
+{
+}
+
+/*
+  starts a new frame, level 0 is grey itself and the other levels are left unfilled
+  level buffers of the previous frame are kept and reused where the size matches
+  @params - grey(equalised grayscale frame)
+*/
+void framePyramid::reset(const Mat &grey)
+{
+    int count = 1;
+    double scale = PYRAMID_FACTOR;
+    while (min(grey.cols, grey.rows) / scale >= PYRAMID_MIN_SIZE){
+        count++;
+        scale *= PYRAMID_FACTOR;
+    }
+    levels.resize(count);
+    filled.assign(count, Rect());
+    scales.resize(count);
+    scale = 1.0;
+    for (int i = 0; i < count; i++){
+        scales[i] = scale;
+        scale *= PYRAMID_FACTOR;
+    }
+    //shares grey's refcount, so the grey pool skips the buffer while a copy of this pyramid still searches it
+    levels[0] = grey;
+    filled[0] = Rect(0, 0, grey.cols, grey.rows);
+}
+
+void framePyramid::release()
+{
+    levels.clear();
+    filled.clear();
+    scales.clear();
+}
+
+void framePyramid::releaseSource()
+{
+    if (!levels.empty()){
+        levels[0].release();
+    }
+}
+
+bool framePyramid::shared() const
+{
+    //level 0 is the grey frame, its buffer is reused by the grey pool and not the pyramid's to hold back
+    for (int i = 1; i < (int)levels.size(); i++){
+        if (levels[i].refcount != NULL && CV_XADD(levels[i].refcount, 0) > 1){
+            return true;
+        }
+    }
+    return false;
+}
+
+int framePyramid::levelFor(double scale) const
+{
+    int level = scale > 1.0 ? cvRound(log(scale) / log(PYRAMID_FACTOR)) : 0;
+    return min(level, levelCount() - 1);
+}
+
+/*
+  the level is only computed where it hasn't been yet, straight from level 0 with an inverse
+  affine map, so every pixel is the same whichever region asked for it first. A region that
+  isn't covered yet extends the filled rect to the bounding rect of both
+  @params - level; roi(level 0 coordinates); area(out, roi at this level, clipped)
+  @returns - the roi at this level, empty if it's outside the frame
+*/
+Mat framePyramid::region(int level, Rect roi, Rect &area)
+{
+    const Mat &base = levels[0];
+    double scale = scales[level];
+    Size size(cvRound(base.cols / scale), cvRound(base.rows / scale));
+    int left = cvFloor(roi.x / scale);
+    int top = cvFloor(roi.y / scale);
+    int right = cvCeil((roi.x + roi.width) / scale);
+    int bottom = cvCeil((roi.y + roi.height) / scale);
+    area = Rect(left, top, right - left, bottom - top) & Rect(0, 0, size.width, size.height);
+    if (area.width <= 0 || area.height <= 0){
+        return Mat();
+    }
+    if (level == 0){
+        return levels[0](area);
+    }
+
+    Mat &buffer = levels[level];
+    buffer.create(size, CV_8U);
+    Rect &done = filled[level];
+    if ((done & area) != area){
+        Rect todo = done.area() > 0 ? (done | area) : area;
+        //level pixel (x,y) samples level 0 at (scale*(x + 0.5) - 0.5), as resize does for the whole frame
+        double map[6] = { scale, 0, scale * (todo.x + 0.5) - 0.5,
+                          0, scale, scale * (todo.y + 0.5) - 0.5 };
+        Mat transform(2, 3, CV_64F, map);
+        Mat dst = buffer(todo);
+        warpAffine(base, dst, transform, dst.size(), INTER_LINEAR | WARP_INVERSE_MAP, BORDER_REPLICATE);
+        done = todo;
+    }
+    return buffer(area);
+}
+
+/*
+  fills the levels findObject will search, so concurrent searches of roi only read the pyramid
+  @params - roi(level 0 coordinates); startScale; window(smallest cascade window that will search it)
+*/
+void framePyramid::prepare(Rect roi, double startScale, Size window)
+{
+    for (int level = levelFor(startScale); level < levelCount(); level++){
+        Rect area;
+        Mat levelRegion = region(level, roi, area);
+        if (levelRegion.cols < window.width || levelRegion.rows < window.height){
+            break;
+        }
+    }
+}
+
+faceTracker::faceTracker()
+{
+    refreshInterval = TRACK_REFRESH;
+    reset();
+}
+
+void faceTracker::reset()
+{
+    QMutexLocker locker(&lock);
+    lastFace = Rect(-1,-1,-1,-1);
+    framesSinceFull = 0;
+    regionSearches = 0;
+    fullSearches = 0;
+}
+
+/*
+  expands the last face by TRACK_MARGIN on every side, clipped to the frame
+  @params - frame(size of frame); roi(out, region to search); face(out, last face rect)
+  @returns - false if there is no face to track or a full search is due
+*/
+bool faceTracker::searchRegion(Size frame, Rect &roi, Rect &face)
+{
+    QMutexLocker locker(&lock);
+    if (lastFace.width <= 0 || framesSinceFull >= refreshInterval){
+        return false;
+    }
+    int marginX = cvRound(lastFace.width * TRACK_MARGIN);
+    int marginY = cvRound(lastFace.height * TRACK_MARGIN);
+    roi = Rect(lastFace.x - marginX, lastFace.y - marginY, lastFace.width + 2*marginX, lastFace.height + 2*marginY);
+    roi &= Rect(0, 0, frame.width, frame.height);
+    if (roi.width <= 0 || roi.height <= 0){
+        return false;
+    }
+    face = lastFace;
+    framesSinceFull++;
+    return true;
+}
+
+/*
+  records the result of a search, an invalid rect drops tracking until the next full search finds a face
+  @params - face(detected rect, invalid if none); fromRegion(true if found by a region search)
+*/
+void faceTracker::update(Rect face, bool fromRegion)
+{
+    QMutexLocker locker(&lock);
+    lastFace = face;
+    if (fromRegion){
+        regionSearches++;
+    }else{
+        framesSinceFull = 0;
+        fullSearches++;
+    }
+}
+
+detectionSettings::detectionSettings()
+{
+    scaledWidth = SCHEDULE[0].scaledWidth;
+    levelStep = SCHEDULE[0].levelStep;
+    minNeighbours = PYRAMID_NEIGHBOURS;
+    minFace = 0;
+    trackFaceSize = SCHEDULE[0].trackFaceSize;
+}
+
+detectionScheduler::detectionScheduler()
+{
+    budget = 0;
+    reset();
+}
+
+void detectionScheduler::reset()
+{
+    QMutexLocker locker(&lock);
+    average = -1;
+    current = 0;
+    sinceChange = 0;
+    lastFaceWidth = 0;
+}
+
+/*
+  settings of the current level, coarser scale steps find fewer hits per face so
+  they are grouped with fewer neighbours
+  @returns - settings for the next face search
+*/
+detectionSettings detectionScheduler::settings()
+{
+    QMutexLocker locker(&lock);
+    const scheduleLevel &step = SCHEDULE[current];
+    detectionSettings settings;
+    settings.scaledWidth = step.scaledWidth;
+    settings.levelStep = step.levelStep;
+    settings.minNeighbours = max(2, PYRAMID_NEIGHBOURS - (step.levelStep - 1));
+    settings.minFace = cvRound(lastFaceWidth * step.minFaceScale);
+    settings.trackFaceSize = step.trackFaceSize;
+    return settings;
+}
+
+/*
+  smooths the frame latency and moves one level down when it is over budget,
+  one level up when it is well under
+  @params - ms(frame latency, queue wait included so a backlog counts)
+*/
+void detectionScheduler::record(double ms)
+{
+    QMutexLocker locker(&lock);
+    average = average < 0 ? ms : average + (ms - average) * SCHEDULE_SMOOTHING;
+    if (budget <= 0 || ++sinceChange < SCHEDULE_HOLD){
+        return;
+    }
+    int next = current;
+    if (average > budget && current < SCHEDULE_LEVELS - 1){
+        next = current + 1;
+    }else if (average < budget * SCHEDULE_HEADROOM && current > 0){
+        next = current - 1;
+    }
+    if (next != current){
+        cout << "Detection level " << next << ", " << cvRound(average) << " ms per frame against " << budget << endl;
+        current = next;
+        sinceChange = 0;
+    }
+}
+
+void detectionScheduler::faceSeen(int width)
+{
+    QMutexLocker locker(&lock);
+    lastFaceWidth = width;
+}
+
+int detectionScheduler::level()
+{
+    QMutexLocker locker(&lock);
+    return current;
+}
 
 detectObject::detectObject()
 {
+    speculativeGlasses = QThread::idealThreadCount() >= 4;
+#if defined(__ARM_NEON__)
+    fastPreprocess = true;
+#else
+    fastPreprocess = false;
+#endif
 }
 
 detectObject::~detectObject()
@@ -42,37 +451,29 @@ detectObject::~detectObject()
 */
 Mat detectObject::processImage(Mat &img, CascadeClassifier &faceCascade, CascadeClassifier &eyeCascade, CascadeClassifier &eyeGlassCascade)
 {
-    Mat greyImage;
-    //check image type and apply appropriate conversion to grayscale, or
-    //copy image if already grayscale
-    switch(img.channels()){
-    case 3:
-        cvtColor(img,greyImage, CV_BGR2GRAY);
-        break;
-    case 4:
-        cvtColor(img, greyImage, CV_BGRA2GRAY);
-        break;
-    default:
-        img.copyTo(greyImage);
-        break;
-    }
-
-    equalizeHist(greyImage, greyImage);     //equalise image
-    //imshow("eq", greyImage);
+    preprocessWorkspace workspace;
+    workspace.concurrentEyes = false;   //would load the extra cascades on every call
+    return processImage(img, faceCascade, eyeCascade, eyeGlassCascade, workspace);
+}
 
+Mat detectObject::processImage(Mat &img, CascadeClassifier &faceCascade, CascadeClassifier &eyeCascade, CascadeClassifier &eyeGlassCascade,
+                               preprocessWorkspace &workspace, faceTracker *tracker)
+{
+    Mat &greyImage = workspace.greyBuffer();
+    framePyramid &pyramid = workspace.pyramidBuffer();
     Rect faceRect;
     Mat faceImage;
     Mat faceAndEyes;
 
     //searches for largest object in image(face)
-    faceRect = findObject(greyImage, faceCascade);
+    faceRect = detectFace(img, greyImage, faceCascade, workspace, tracker, &pyramid);
     //if found
     if (faceRect.width > 0){
         //isolate area in original image
         faceImage = greyImage(faceRect);
         Point leftEye, rightEye;
         //search reduced image for eye shapes
-        faceAndEyes = detectEyes(faceImage, eyeCascade, eyeGlassCascade, leftEye, rightEye);
+        faceAndEyes = detectEyes(faceImage, eyeCascade, eyeGlassCascade, leftEye, rightEye, workspace, &pyramid);
         //imshow("faceImage",faceImage);
     }else{
         //cout << "no face found" << endl;
@@ -85,6 +486,105 @@ Mat detectObject::processImage(Mat &img, CascadeClassifier &faceCascade, Cascade
     return faceAndEyes;
 }
 
+/*
+  first half of processImage, converts to an equalised grayscale image and finds the face
+  with a tracker only the region around the last face is searched, at a scale that puts the
+  face near TRACK_FACE_SIZE and with the cascade limited to nearby face sizes. A miss falls
+  back to a full frame search in the same frame
+  with a pyramid the searches run over its levels, which detectEyes can then reuse
+  @params - img (input image); greyImage (output grayscale image); faceCascade; tracker (optional); pyramid (optional);
+            scheduler (optional, picks the search settings for this frame)
+  @returns - Rect of the face in greyImage, invalid (-1) if none found
+*/
+Rect detectObject::detectFace(Mat &img, Mat &greyImage, CascadeClassifier &faceCascade)
+{
+    preprocessWorkspace workspace;
+    return detectFace(img, greyImage, faceCascade, workspace);
+}
+
+Rect detectObject::detectFace(Mat &img, Mat &greyImage, CascadeClassifier &faceCascade, preprocessWorkspace &workspace,
+                              faceTracker *tracker, framePyramid *pyramid, detectionScheduler *scheduler)
+{
+    //check image type and apply appropriate conversion to grayscale, a
+    //grayscale image (native capture) is equalised straight from the frame
+    switch(img.channels()){
+    case 3:
+        cvtColor(img,greyImage, CV_BGR2GRAY);
+        equalizeHist(greyImage, greyImage);     //equalise image
+        break;
+    case 4:
+        cvtColor(img, greyImage, CV_BGRA2GRAY);
+        equalizeHist(greyImage, greyImage);
+        break;
+    default:
+        equalizeHist(img, greyImage);
+        break;
+    }
+    //imshow("eq", greyImage);
+    if (pyramid != NULL){
+        pyramid->reset(greyImage);
+    }
+
+    Rect frame(0, 0, greyImage.cols, greyImage.rows);
+    detectionSettings settings = scheduler != NULL ? scheduler->settings() : detectionSettings();
+    Rect face;
+
+    Rect roi, lastFace;
+    if (tracker != NULL && tracker->searchRegion(greyImage.size(), roi, lastFace)){
+        int scaledWidth = max(1, cvRound(roi.width * settings.trackFaceSize / (float)lastFace.width));
+        float expected = (roi.width > scaledWidth) ? (float)settings.trackFaceSize : (float)lastFace.width;
+        Size minSize(cvRound(expected * TRACK_MIN_SCALE), cvRound(expected * TRACK_MIN_SCALE));
+        Size maxSize(cvRound(expected * TRACK_MAX_SCALE), cvRound(expected * TRACK_MAX_SCALE));
+
+        face = searchFace(greyImage, roi, faceCascade, scaledWidth, workspace, pyramid, settings, minSize, maxSize);
+        if (face.width > 0){
+            tracker->update(face, true);
+        }
+    }
+
+    if (face.width <= 0){
+        //no tracking, lost the face or due a refresh, search the whole frame
+        //when behind schedule faces much smaller than the last one aren't looked for
+        double scale = greyImage.cols > settings.scaledWidth ? greyImage.cols / (double)settings.scaledWidth : 1.0;
+        int minFace = max(FACE_MIN_SIZE, cvRound(settings.minFace / scale));
+        face = searchFace(greyImage, frame, faceCascade, settings.scaledWidth, workspace, pyramid, settings, Size(minFace, minFace));
+        if (tracker != NULL){
+            tracker->update(face, false);
+        }
+    }
+    if (scheduler != NULL && face.width > 0){
+        scheduler->faceSeen(face.width);
+    }
+    return face;
+}
+
+/*
+  one face search of roi, with the region shrunk to scaledWidth or through the pyramid from the same scale
+  @params - greyImage; roi; faceCascade; scaledWidth; workspace; pyramid(NULL to resize the region)
+            settings(scale step and grouping, pyramid searches only); minSize, maxSize(face size limits in the scaled region)
+  @returns - Rect of the face in greyImage, invalid (-1) if none found
+*/
+Rect detectObject::searchFace(Mat &greyImage, Rect roi, CascadeClassifier &faceCascade, int scaledWidth,
+                              preprocessWorkspace &workspace, framePyramid *pyramid, const detectionSettings &settings,
+                              Size minSize, Size maxSize)
+{
+    scopedLatency timing(STAT_FACE_SEARCH);
+    if (pyramid != NULL){
+        double scale = roi.width > scaledWidth ? roi.width / (double)scaledWidth : 1.0;
+        Size frameMin(cvRound(minSize.width * scale), cvRound(minSize.height * scale));
+        Size frameMax(cvRound(maxSize.width * scale), cvRound(maxSize.height * scale));
+        return findObject(*pyramid, roi, faceCascade, scale, workspace.objects, workspace.candidates, frameMin, frameMax, settings);
+    }
+
+    Mat region = greyImage(roi);
+    Rect face = findObject(region, faceCascade, scaledWidth, workspace, minSize, maxSize);
+    if (face.width > 0){
+        face.x += roi.x;
+        face.y += roi.y;
+    }
+    return face;
+}
+
 /*
   initialises cascade objects
 */
@@ -123,16 +623,28 @@ void detectObject::initCascades(CascadeClassifier &faceCascade, CascadeClassifie
   finds largest object in the input image
   classifier determines whether face or eyes are detected
   @params - image(input image), cascade(face or eyes), scaledWidth(for normalising image)
+            minSize, maxSize(object size limits in the scaled image, empty maxSize = no limit)
   @returns - Rect (co-ordinates of detected object)
 */
 
 Rect detectObject::findObject(Mat &image, CascadeClassifier &cascade,  int scaledWidth)
+{
+    preprocessWorkspace workspace;
+    return findObject(image, cascade, scaledWidth, workspace);
+}
+
+Rect detectObject::findObject(Mat &image, CascadeClassifier &cascade,  int scaledWidth, preprocessWorkspace &workspace,
+                              Size minSize, Size maxSize)
+{
+    return findObject(image, cascade, scaledWidth, workspace.searchImage, workspace.objects, minSize, maxSize);
+}
+
+Rect detectObject::findObject(Mat &image, CascadeClassifier &cascade,  int scaledWidth, Mat &searchImage, vector<Rect> &objects,
+                              Size minSize, Size maxSize)
 {
     int flags = CASCADE_FIND_BIGGEST_OBJECT; //search for 1 large object
-    Size minSize = Size(20,20);
     float searchDetailFactor = 1.1f; //higher no. = more strict search, must be > 1.0
     int minNeighbours = 4;  //detection filter. 2 = good+bad, 6=good but some missed, 4 is decent average
-    vector<Rect> objects;
     Mat srchImage;
 
     //Detect if object can be shrunk to increase detection speed
@@ -141,15 +653,16 @@ Rect detectObject::findObject(Mat &image, CascadeClassifier &cascade,  int scale
         //shrink image while keeping aspect ratio
         int scaledHeight = cvRound(image.rows/scale);
         try{
-            resize(image, srchImage, Size(scaledWidth, scaledHeight));
+            resize(image, searchImage, Size(scaledWidth, scaledHeight));
         }catch(cv::Exception &e){}
+        srchImage = searchImage;
         //imshow("scaled", srchImage);
     }else{
         srchImage = image;
     }
 
     //opencv's detection function
-    cascade.detectMultiScale(srchImage, objects, searchDetailFactor, minNeighbours, flags, minSize);
+    cascade.detectMultiScale(srchImage, objects, searchDetailFactor, minNeighbours, flags, minSize, maxSize);
 
     // Enlarge the results if the image was temporarily shrunk before detection.
     if (image.cols > scaledWidth) {
@@ -182,6 +695,153 @@ Rect detectObject::findObject(Mat &image, CascadeClassifier &cascade,  int scale
     return rect;
 }
 
+/*
+  largest object in roi, searched over the pyramid levels rather than detectMultiScale's own
+  rescaled copies. Each level is searched at the cascade's window size only, the hits of every
+  level are mapped back to the frame and grouped once, as detectMultiScale would have done
+  @params - pyramid; roi(region of level 0 to search); cascade; startScale(first scale searched, as
+            frame width / scaledWidth); objects, candidates(scratch); minSize, maxSize(frame pixels, empty = no limit);
+            settings(levels stepped and neighbours grouped)
+  @returns - Rect of the object in level 0 co-ordinates, invalid if none found
+*/
+Rect detectObject::findObject(framePyramid &pyramid, Rect roi, CascadeClassifier &cascade, double startScale,
+                              vector<Rect> &objects, vector<Rect> &candidates, Size minSize, Size maxSize,
+                              const detectionSettings &settings)
+{
+    Size window = cascade.getOriginalWindowSize();
+    candidates.clear();
+    for (int level = pyramid.levelFor(startScale); level < pyramid.levelCount(); level += settings.levelStep){
+        double scale = pyramid.scale(level);
+        Size objectSize(cvRound(window.width * scale), cvRound(window.height * scale));
+        if (maxSize.width > 0 && (objectSize.width > maxSize.width || objectSize.height > maxSize.height)){
+            break;
+        }
+        if (objectSize.width < minSize.width || objectSize.height < minSize.height){
+            continue;
+        }
+        Rect area;
+        Mat levelRegion = pyramid.region(level, roi, area);
+        if (levelRegion.cols < window.width || levelRegion.rows < window.height){
+            break;
+        }
+
+        //minNeighbours 0 leaves the raw hits ungrouped
+        cascade.detectMultiScale(levelRegion, objects, PYRAMID_FACTOR, 0, 0, window, window);
+        for (int i = 0; i < (int)objects.size(); i++){
+            candidates.push_back(Rect(cvRound((objects[i].x + area.x) * scale), cvRound((objects[i].y + area.y) * scale),
+                                      objectSize.width, objectSize.height));
+        }
+    }
+    groupRectangles(candidates, settings.minNeighbours, PYRAMID_GROUP_EPS);
+
+    Rect rect(-1,-1,-1,-1);
+    for (int i = 0; i < (int)candidates.size(); i++){
+        if (candidates[i].area() > rect.area()){
+            rect = candidates[i];
+        }
+    }
+    if (rect.width > 0){
+        //keep it inside the roi, in case it was on a border
+        rect.x = max(roi.x, min(rect.x, roi.x + roi.width - rect.width));
+        rect.y = max(roi.y, min(rect.y, roi.y + roi.height - rect.height));
+    }
+    return rect;
+}
+
+/*
+  one eye search, safe to run on a pool thread as long as the cascade and buffers aren't shared
+  with buffers->pyramid set the region is searched in the frame's pyramid, which must be prepared
+  @params - detection; region(eye region of the face); cascade; buffers; stage(latency stat)
+  @returns - eye rect in region, invalid if not found
+*/
+static Rect searchEye(detectObject *detection, Mat region, CascadeClassifier *cascade, eyeSearchBuffers *buffers, int stage)
+{
+    scopedLatency timing(stage);
+    if (buffers->pyramid == NULL){
+        return detection->findObject(region, *cascade, region.cols, buffers->searchImage, buffers->objects);
+    }
+
+    Size frame;
+    Point offset;
+    region.locateROI(frame, offset);
+    Rect eye = detection->findObject(*buffers->pyramid, Rect(offset, region.size()), *cascade, 1.0,
+                                     buffers->objects, buffers->candidates);
+    if (eye.width > 0){
+        eye.x -= offset.x;
+        eye.y -= offset.y;
+    }
+    return eye;
+}
+
+/*
+  loads the workspace's own right eye cascades the first time they're needed
+  @params - workspace
+  @returns - false if they can't be loaded, eyes are then searched one after the other
+*/
+bool detectObject::loadEyeCascades(preprocessWorkspace &workspace)
+{
+    if (!workspace.eyeCascadesTried){
+        workspace.eyeCascadesTried = true;
+        try{
+            workspace.rightEyeCascade.load(eyeCascadeFilename1);
+            workspace.rightGlassesCascade.load(eyeCascadeFilename2);
+        }catch(cv::Exception){}
+    }
+    return !workspace.rightEyeCascade.empty() && !workspace.rightGlassesCascade.empty();
+}
+
+/*
+  searches both eyes at once, the right eye on the thread pool and the left on this thread.
+  With speculativeGlasses the glasses cascade runs for both eyes at the same time as the plain
+  one, otherwise only for the eyes the plain cascade missed, so finding the eyes takes one or
+  two cascade passes rather than up to four
+  @params - topLeftFace, topRightFace(eye regions); eyeCascade1(normal eye); eyeCascade2(eye with glasses)
+            workspace; leftEyeRect, rightEyeRect(out, in region coordinates, invalid if not found)
+*/
+void detectObject::searchEyes(Mat &topLeftFace, Mat &topRightFace, CascadeClassifier &eyeCascade1, CascadeClassifier &eyeCascade2,
+                              preprocessWorkspace &workspace, Rect &leftEyeRect, Rect &rightEyeRect)
+{
+    eyeSearchBuffers *buffers = workspace.eyeBuffers;
+    QFuture<Rect> right = QtConcurrent::run(searchEye, this, topRightFace, &workspace.rightEyeCascade,
+                                            &buffers[RIGHT_EYE_SEARCH], (int)STAT_RIGHT_EYE);
+    QFuture<Rect> leftGlasses;
+    QFuture<Rect> rightGlasses;
+    if (speculativeGlasses){
+        leftGlasses = QtConcurrent::run(searchEye, this, topLeftFace, &eyeCascade2,
+                                        &buffers[LEFT_GLASSES_SEARCH], (int)STAT_LEFT_EYE_GLASSES);
+        rightGlasses = QtConcurrent::run(searchEye, this, topRightFace, &workspace.rightGlassesCascade,
+                                         &buffers[RIGHT_GLASSES_SEARCH], (int)STAT_RIGHT_EYE_GLASSES);
+    }
+    leftEyeRect = searchEye(this, topLeftFace, &eyeCascade1, &buffers[LEFT_EYE_SEARCH], STAT_LEFT_EYE);
+    rightEyeRect = right.result();
+
+    if (speculativeGlasses){
+        //every search reads this face, wait for all of them
+        Rect leftGlassesRect = leftGlasses.result();
+        Rect rightGlassesRect = rightGlasses.result();
+        if (leftEyeRect.width <= 0){
+            leftEyeRect = leftGlassesRect;
+        }
+        if (rightEyeRect.width <= 0){
+            rightEyeRect = rightGlassesRect;
+        }
+        return;
+    }
+
+    //try again with eyeGlasses, side by side if both eyes were missed
+    if (leftEyeRect.width <= 0 && rightEyeRect.width <= 0){
+        rightGlasses = QtConcurrent::run(searchEye, this, topRightFace, &workspace.rightGlassesCascade,
+                                         &buffers[RIGHT_GLASSES_SEARCH], (int)STAT_RIGHT_EYE_GLASSES);
+        leftEyeRect = searchEye(this, topLeftFace, &eyeCascade2, &buffers[LEFT_GLASSES_SEARCH], STAT_LEFT_EYE_GLASSES);
+        rightEyeRect = rightGlasses.result();
+    }else if (leftEyeRect.width <= 0){
+        leftEyeRect = searchEye(this, topLeftFace, &eyeCascade2, &buffers[LEFT_GLASSES_SEARCH], STAT_LEFT_EYE_GLASSES);
+    }else if (rightEyeRect.width <= 0){
+        rightEyeRect = searchEye(this, topRightFace, &workspace.rightGlassesCascade, &buffers[RIGHT_GLASSES_SEARCH],
+                                 STAT_RIGHT_EYE_GLASSES);
+    }
+}
+
 /*
   detect eyes in scaled face image
   sets expected position parameters and runs detection
@@ -189,10 +849,19 @@ Rect detectObject::findObject(Mat &image, CascadeClassifier &cascade,  int scale
   @params - face (scaled face image); eyeCascade1(normal eye); eyeCascade2(eye with galsses)
             leftEye(co-ordinates centre point of left eye)
             rightEye(co-ordinates of centre point of right eye)
+            pyramid(optional, the frame's pyramid from detectFace when face is a region of that frame)
   @returns - scaled and warped image used in FaceRecogniser
 */
 Mat detectObject::detectEyes(Mat& face, CascadeClassifier &eyeCascade1, CascadeClassifier &eyeCascade2,
                                 Point &leftEye, Point &rightEye)
+{
+    preprocessWorkspace workspace;
+    workspace.concurrentEyes = false;
+    return detectEyes(face, eyeCascade1, eyeCascade2, leftEye, rightEye, workspace);
+}
+
+Mat detectObject::detectEyes(Mat& face, CascadeClassifier &eyeCascade1, CascadeClassifier &eyeCascade2,
+                                Point &leftEye, Point &rightEye, preprocessWorkspace &workspace, framePyramid *pyramid)
 {
     //default values for eye.xml & eyeglasses.xml
     const float EYE_XPOS = 0.16f;
@@ -211,10 +880,41 @@ Mat detectObject::detectEyes(Mat& face, CascadeClassifier &eyeCascade1, CascadeC
     Mat topLeftFace = face(Rect(leftX, topY, widthX, heightY));
     Mat topRightFace = face(Rect(rightX, topY, widthX, heightY));
 
-    //search for eyes in each focused image
+    //search the frame's pyramid if face was cut from it, the eye regions are mapped to the frame
+    if (pyramid != NULL && (pyramid->source().empty() || pyramid->source().datastart != face.datastart)){
+        pyramid = NULL;
+    }
+    for (int i = 0; i < EYE_SEARCHES; i++){
+        workspace.eyeBuffers[i].pyramid = pyramid;
+    }
+
+    //search for eyes in each focused image, falling back to the glasses cascade for a missed eye
     Rect leftEyeRect, rightEyeRect;
-    leftEyeRect = findObject(topLeftFace, eyeCascade1, topLeftFace.cols);
-    rightEyeRect = findObject(topRightFace, eyeCascade1 , topRightFace.cols);
+    if (workspace.concurrentEyes && loadEyeCascades(workspace)){
+        if (pyramid != NULL){
+            //fill both regions before the searches share the pyramid
+            Size frame;
+            Point offset;
+            face.locateROI(frame, offset);
+            Rect eyes = Rect(leftX, topY, widthX, heightY) | Rect(rightX, topY, widthX, heightY);
+            Size window1 = eyeCascade1.getOriginalWindowSize();
+            Size window2 = eyeCascade2.getOriginalWindowSize();
+            pyramid->prepare(eyes + offset, 1.0, Size(min(window1.width, window2.width), min(window1.height, window2.height)));
+        }
+        searchEyes(topLeftFace, topRightFace, eyeCascade1, eyeCascade2, workspace, leftEyeRect, rightEyeRect);
+    }else{
+        eyeSearchBuffers *buffers = workspace.eyeBuffers;
+        leftEyeRect = searchEye(this, topLeftFace, &eyeCascade1, &buffers[LEFT_EYE_SEARCH], STAT_LEFT_EYE);
+        if (leftEyeRect.width <= 0){
+            leftEyeRect = searchEye(this, topLeftFace, &eyeCascade2, &buffers[LEFT_GLASSES_SEARCH], STAT_LEFT_EYE_GLASSES);
+        }
+        if (leftEyeRect.width > 0){
+            rightEyeRect = searchEye(this, topRightFace, &eyeCascade1, &buffers[RIGHT_EYE_SEARCH], STAT_RIGHT_EYE);
+            if (rightEyeRect.width <= 0){
+                rightEyeRect = searchEye(this, topRightFace, &eyeCascade2, &buffers[RIGHT_GLASSES_SEARCH], STAT_RIGHT_EYE_GLASSES);
+            }
+        }
+    }
 
     if (leftEyeRect.width > 0) {   // Check if the eye was detected.
         leftEyeRect.x += leftX;    // Adjust the left-eye rectangle because the face border was removed.
@@ -222,20 +922,11 @@ Mat detectObject::detectEyes(Mat& face, CascadeClassifier &eyeCascade1, CascadeC
         leftEye = Point(leftEyeRect.x + leftEyeRect.width/2, leftEyeRect.y + leftEyeRect.height/2);
         //cout << "Left eye: " << leftEye << endl;
     }
-    else {
-        //try again with eyeGlasses
-        leftEyeRect = findObject(topLeftFace, eyeCascade2, topLeftFace.cols);
-        if (leftEyeRect.width > 0) {   // Check if the eye was detected.
-            leftEyeRect.x += leftX;    // Adjust the left-eye rectangle because the face border was removed.
-            leftEyeRect.y += topY;
-            leftEye = Point(leftEyeRect.x + leftEyeRect.width/2, leftEyeRect.y + leftEyeRect.height/2);
-        }
-        else{
-            leftEye = Point(-1, -1);    // Return an invalid point
-            cout << "badleft" << endl;
-            topLeftFace = Mat();
-            return topLeftFace;
-        }
+    else{
+        leftEye = Point(-1, -1);    // Return an invalid point
+        cout << "badleft" << endl;
+        topLeftFace = Mat();
+        return topLeftFace;
     }
 
     if (rightEyeRect.width > 0) { // Check if the eye was detected.
@@ -244,20 +935,11 @@ Mat detectObject::detectEyes(Mat& face, CascadeClassifier &eyeCascade1, CascadeC
         rightEye = Point(rightEyeRect.x + rightEyeRect.width/2, rightEyeRect.y + rightEyeRect.height/2);
         //cout << "Right eye : " << rightEye << endl;
     }
-    else {
-        //try again with eyeGlasses
-        rightEyeRect = findObject(topRightFace, eyeCascade1 , topRightFace.cols);
-        if (rightEyeRect.width > 0) { // Check if the eye was detected.
-            rightEyeRect.x += rightX; // Adjust the right-eye rectangle, since it starts on the right side of the image.
-            rightEyeRect.y += topY;  // Adjust the right-eye rectangle because the face border was removed.
-            rightEye = Point(rightEyeRect.x + rightEyeRect.width/2, rightEyeRect.y + rightEyeRect.height/2);
-        }
-        else{
-            rightEye = Point(-1, -1);    // Return an invalid point
-            cout << "badright" << endl;
-            topRightFace = Mat();
-            return topRightFace;
-        }
+    else{
+        rightEye = Point(-1, -1);    // Return an invalid point
+        cout << "badright" << endl;
+        topRightFace = Mat();
+        return topRightFace;
     }
 
     //check got both eyes
@@ -281,30 +963,57 @@ Mat detectObject::detectEyes(Mat& face, CascadeClassifier &eyeCascade1, CascadeC
         double desiredLen = (DESIRED_RIGHT_EYE_X - DESIRED_LEFT_EYE_X) * desiredFaceWidth;
         double scaleFactor = desiredLen/ len;
         //get the transformation matrix for rotating and scaling
-        Mat rot_mat = getRotationMatrix2D(eyesCenter, angle, scaleFactor);
+        //same as getRotationMatrix2D but written into the workspace's matrix
+        Mat &rot_mat = workspace.rotation;
+        double alpha = scaleFactor * cos(angle * CV_PI/180.0);
+        double beta = scaleFactor * sin(angle * CV_PI/180.0);
+        rot_mat.at<double>(0,0) = alpha;
+        rot_mat.at<double>(0,1) = beta;
+        rot_mat.at<double>(0,2) = (1 - alpha) * eyesCenter.x - beta * eyesCenter.y;
+        rot_mat.at<double>(1,0) = -beta;
+        rot_mat.at<double>(1,1) = alpha;
+        rot_mat.at<double>(1,2) = beta * eyesCenter.x + (1 - alpha) * eyesCenter.y;
         //shift eyecenter to desired value
         rot_mat.at<double>(0,2) += desiredFaceWidth * 0.5f - eyesCenter.x;
         rot_mat.at<double>(1,2) += desiredFaceHeight * DESIRED_LEFT_EYE_Y - eyesCenter.y;
 
         //rotate, scale and translate image to desired position
-        Mat warped = Mat(desiredFaceHeight, desiredFaceWidth, CV_8U, Scalar(128));//clear an output Mat to default grey
-        warpAffine(face, warped, rot_mat, warped.size());
+        workspace.prepare(desiredFaceWidth);
+        Mat &warped = workspace.warped;
+        {
+            scopedLatency timing(STAT_WARP);
+            if (fastPreprocess){
+                warpFace(face, warped, rot_mat);
+            }else{
+                warpAffine(face, warped, rot_mat, warped.size());
+            }
+        }
 
-        equalizeLeftAndRightHalves(warped);
+        equalizeLeftAndRightHalves(warped, workspace);
 
         //smooth image
-        Mat filtered = Mat(warped.size(), CV_8U);
-        bilateralFilter(warped, filtered, 0, 20.0, 20.0);;
+        Mat &filtered = workspace.filtered;
+        {
+            scopedLatency timing(STAT_FILTER);
+            if (fastPreprocess){
+                bilateralFace(warped, filtered, workspace.padded, workspace.bilateral, 20.0, 20.0);
+            }else{
+                bilateralFilter(warped, filtered, 0, 20.0, 20.0);
+            }
+        }
 
         //filter out corners of face to focus on middle parts
-        Mat mask = Mat(warped.size(), CV_8U, Scalar(0)); //start with empty mask
-        Point faceCenter = Point(desiredFaceWidth/2, cvRound(desiredFaceHeight * FACE_ELLIPSE_CY));
-        Size size = Size(cvRound(desiredFaceWidth * FACE_ELLIPSE_W), cvRound(desiredFaceHeight * FACE_ELLIPSE_H));
-        ellipse(mask, faceCenter, size, 0, 0, 360, Scalar(255), CV_FILLED);
-
-        //use the mask to remove outside pixels
-        Mat dstImg = Mat(warped.size(), CV_8U, Scalar(128));
-        filtered.copyTo(dstImg,mask);
+        //use the mask (built once per face size) to remove outside pixels
+        Mat &dstImg = workspace.faceBuffer();
+        if (defaultFace::fits(filtered)){
+            defaultFace::applyMask(filtered, 128, dstImg);
+        }else if (fastPreprocess){
+            maskFace(filtered, workspace.mask, 128, dstImg);
+        }else{
+            dstImg.create(warped.size(), CV_8U);
+            dstImg.setTo(Scalar(128));
+            filtered.copyTo(dstImg, workspace.mask);
+        }
         //imshow("dst",dstImg);
         return dstImg;
     }
@@ -319,9 +1028,55 @@ Mat detectObject::detectEyes(Mat& face, CascadeClassifier &eyeCascade1, CascadeC
   common for uneven light coniditions across face
   equalise left & right separately, then again equalise resultt
   this creates an average across t eentire image
+  the halves are equalised in place, so the blend is one fixed point multiply-add per pixel
+  between faceImg and the whole face using weights precomputed per column
   @params - scaled face image
 */
 void detectObject::equalizeLeftAndRightHalves(Mat &faceImg)   //seperately equalise left and right halves of face
+{
+    preprocessWorkspace workspace;
+    equalizeLeftAndRightHalves(faceImg, workspace);
+}
+
+void detectObject::equalizeLeftAndRightHalves(Mat &faceImg, preprocessWorkspace &workspace)
+{
+    int width = faceImg.cols;
+    int height = faceImg.rows;
+    workspace.prepare(width);
+    Mat &wholeFace = workspace.wholeFace;
+    //equalise the whole face and the 2 halves
+    int midX = width/2;
+    Mat leftSide = faceImg(Rect(0,0,midX,height));
+    Mat rightSide = faceImg(Rect(midX, 0, width-midX, height));
+    if (fastPreprocess){
+        equalizeFace(faceImg, wholeFace);
+        equalizeFace(leftSide, leftSide);
+        equalizeFace(rightSide, rightSide);
+    }else{
+        equalizeHist(faceImg, wholeFace);
+        equalizeHist(leftSide, leftSide);
+        equalizeHist(rightSide, rightSide);
+    }
+
+    //combine two halves and make a smooth tranisition upon edge
+    if (defaultFace::fits(faceImg) && defaultFace::fits(wholeFace)){
+        defaultFace::blend(faceImg, wholeFace);
+        return;
+    }
+    const ushort *weights = &workspace.blendWeights[0];
+    for (int y = 0; y < height; y++){
+        uchar *row = faceImg.ptr<uchar>(y);
+        blendRow(row, wholeFace.ptr<uchar>(y), weights, row, width);
+    }
+    return;
+}
+
+/*
+  original per pixel version of equalizeLeftAndRightHalves
+  kept as the reference the vectorised version is checked against, results differ by at most 1
+  @params - scaled face image
+*/
+void detectObject::equalizeLeftAndRightHalvesReference(Mat &faceImg)   //seperately equalise left and right halves of face
 {
 
     int width = faceImg.cols;
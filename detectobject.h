@@ -2,11 +2,177 @@
 #define DETECTFACE_H
 
 #include <QObject>
+#include <QMutex>
 #include "opencv2/core/core.hpp"
 #include "opencv2/objdetect/objdetect.hpp"
 
+#include "facefilters.h"
+
+#include <vector>
+
 using namespace cv;
 
+const int FACE_WIDTH = 70;      // preprocessed faces are FACE_WIDTH x FACE_WIDTH
+const int WORKSPACE_POOL = 4;   // frame/face buffers per workspace that can be in flight downstream
+
+enum eyeSearchSlot { LEFT_EYE_SEARCH, RIGHT_EYE_SEARCH, LEFT_GLASSES_SEARCH, RIGHT_GLASSES_SEARCH, EYE_SEARCHES };
+
+/*
+  Grayscale frame at successive 1/1.1 scales, shared by the face and eye searches of one frame.
+  Levels are filled lazily and only over the regions searched, so the eye searches only resize their
+  own regions and reuse whatever the face search already built. Level 0 is the frame itself.
+  Filling isn't thread safe, prepare() every region before searching it from several threads.
+*/
+struct framePyramid
+{
+    framePyramid();
+
+    void reset(const Mat &grey);
+    // drops every level, the buffers are left to whoever still holds them
+    void release();
+    // drops level 0 once the frame is done with, so the grey pool can reuse its buffer
+    void releaseSource();
+    // true while a copy (e.g. in a pipeline item) still holds the levels
+    bool shared() const;
+
+    const Mat &source() const { return levels.empty() ? empty : levels[0]; }
+    int levelCount() const { return (int)levels.size(); }
+    double scale(int level) const { return scales[level]; }
+    // level whose scale is nearest to scale
+    int levelFor(double scale) const;
+    // roi (level 0 coordinates) at the given level, filled if needed; area is the roi in level coordinates
+    Mat region(int level, Rect roi, Rect &area);
+    // fills roi in every level a search from startScale would visit with a cascade of window size
+    void prepare(Rect roi, double startScale, Size window);
+
+private:
+    std::vector<Mat> levels;
+    std::vector<Rect> filled;       // part of each level computed so far
+    std::vector<double> scales;
+    Mat empty;
+};
+
+// Scratch for one eye search, the searches of one face can run at the same time.
+struct eyeSearchBuffers
+{
+    eyeSearchBuffers() : pyramid(NULL) {}
+
+    framePyramid *pyramid;          // frame the eye regions are cut from, NULL to search the region images themselves
+    Mat searchImage;
+    std::vector<Rect> objects;
+    std::vector<Rect> candidates;   // raw detections over all pyramid levels, grouped at the end
+};
+
+/*
+  Buffers reused for every face one thread preprocesses, so steady state preprocessing doesn't allocate.
+  Not thread safe, each worker thread owns one.
+*/
+struct preprocessWorkspace
+{
+    preprocessWorkspace();
+
+    // builds the constant mask and blend weights for the output face size, once
+    void prepare(int width);
+    // a grey frame / output face buffer that nothing downstream still holds
+    Mat &greyBuffer();
+    Mat &faceBuffer();
+    // a pyramid that nothing downstream still holds
+    framePyramid &pyramidBuffer();
+
+    int faceWidth;
+    Mat mask;                       // ellipse that removes the corners of the face, read only (shared for the default size)
+    std::vector<ushort> blendWeights;   // per column weights for equalizeLeftAndRightHalves
+    Mat rotation;                   // 2x3 affine for aligning the eyes
+    Mat warped;
+    Mat filtered;
+    Mat padded;                     // bordered face for bilateralFace
+    bilateralTables bilateral;
+    Mat wholeFace;
+    Mat searchImage;                // downscaled frame for findObject
+    std::vector<Rect> objects;
+    std::vector<Rect> candidates;
+
+    // eye searches run concurrently when set, off for the temporary workspaces of the old signatures
+    bool concurrentEyes;
+    // cascades aren't thread safe, the right eye searches get their own instances
+    bool eyeCascadesTried;
+    CascadeClassifier rightEyeCascade;
+    CascadeClassifier rightGlassesCascade;
+    eyeSearchBuffers eyeBuffers[EYE_SEARCHES];
+
+private:
+    Mat &pooled(Mat *pool, int &next);
+    Mat greyPool[WORKSPACE_POOL];
+    Mat facePool[WORKSPACE_POOL];
+    framePyramid pyramidPool[WORKSPACE_POOL];
+    int nextGrey;
+    int nextFace;
+    int nextPyramid;
+};
+
+/*
+  Where the face was last seen, so the following frames only search an expanded region around it.
+  A full frame search runs after the face is lost and every refreshInterval frames. Thread safe.
+*/
+struct faceTracker
+{
+    faceTracker();
+    void reset();
+    // region to search this frame, false if a full frame search is due
+    bool searchRegion(Size frame, Rect &roi, Rect &lastFace);
+    void update(Rect face, bool fromRegion);
+
+    int refreshInterval;
+    int regionSearches;             // frames served by a region search
+    int fullSearches;
+
+private:
+    QMutex lock;
+    Rect lastFace;
+    int framesSinceFull;
+};
+
+// Face search settings for one frame, the defaults are the full quality search.
+struct detectionSettings
+{
+    detectionSettings();
+
+    int scaledWidth;        // full frame searches start at the scale that shrinks the frame to this width
+    int levelStep;          // pyramid levels advanced per search scale, 1 = 1.1x, 2 = 1.21x, 3 = 1.33x
+    int minNeighbours;      // hits grouped into a detection, fewer levels give fewer hits per face
+    int minFace;            // smallest face a full frame search looks for, frame pixels, 0 = no limit
+    int trackFaceSize;      // a tracked face is scaled to about this many pixels for the search
+};
+
+/*
+  Picks the face search settings per frame to keep the measured frame latency within budget.
+  Over budget it steps down to a coarser level: fewer scales and a smaller search image, and
+  full frame searches that skip faces much smaller than the last one seen. It steps back up
+  once there is headroom again. Thread safe.
+*/
+class detectionScheduler
+{
+public:
+    detectionScheduler();
+    void reset();
+
+    detectionSettings settings();
+    // ms from a frame being queued to its face search finishing
+    void record(double ms);
+    // width of a face just found, frame pixels
+    void faceSeen(int width);
+    int level();
+
+    double budget;          // ms per frame, 0 = always search at full quality
+
+private:
+    QMutex lock;
+    double average;         // smoothed frame latency, -1 before the first frame
+    int current;
+    int sinceChange;        // frames recorded at the current level
+    int lastFaceWidth;
+};
+
 class detectObject : public QObject
 {
     Q_OBJECT
@@ -17,12 +183,42 @@ public:
     void detectLargestObject();
     void initCascades(CascadeClassifier& faceCascade, CascadeClassifier& eyeCascade, CascadeClassifier& eyeGlassesCascade);
     void equalizeLeftAndRightHalves(Mat &faceImg);
+    void equalizeLeftAndRightHalves(Mat &faceImg, preprocessWorkspace &workspace);
+    void equalizeLeftAndRightHalvesReference(Mat &faceImg);
 
+    // versions without a workspace allocate a temporary one per call
     Rect findObject(Mat &image, CascadeClassifier &cascade, int scaledWidth = 320);
+    Rect findObject(Mat &image, CascadeClassifier &cascade, int scaledWidth, preprocessWorkspace &workspace,
+                    Size minSize = Size(20,20), Size maxSize = Size());
+    Rect findObject(Mat &image, CascadeClassifier &cascade, int scaledWidth, Mat &searchImage, std::vector<Rect> &objects,
+                    Size minSize = Size(20,20), Size maxSize = Size());
+    // pyramid version, roi/sizes/result are in frame (level 0) pixels and the search starts at startScale
+    Rect findObject(framePyramid &pyramid, Rect roi, CascadeClassifier &cascade, double startScale,
+                    std::vector<Rect> &objects, std::vector<Rect> &candidates, Size minSize = Size(), Size maxSize = Size(),
+                    const detectionSettings &settings = detectionSettings());
     Mat detectEyes(Mat& face, CascadeClassifier &eyeCascade1, CascadeClassifier &eyeCascade2, Point &leftEye, Point &rightEye);
+    Mat detectEyes(Mat& face, CascadeClassifier &eyeCascade1, CascadeClassifier &eyeCascade2, Point &leftEye, Point &rightEye,
+                   preprocessWorkspace &workspace, framePyramid *pyramid = NULL);
+    Rect detectFace(Mat &img, Mat &greyImage, CascadeClassifier &faceCascade);
+    Rect detectFace(Mat &img, Mat &greyImage, CascadeClassifier &faceCascade, preprocessWorkspace &workspace,
+                    faceTracker *tracker = NULL, framePyramid *pyramid = NULL, detectionScheduler *scheduler = NULL);
     Mat processImage(Mat &img, CascadeClassifier& faceCascade, CascadeClassifier& eyeCascade, CascadeClassifier& eyeGlassCascade);
+    Mat processImage(Mat &img, CascadeClassifier& faceCascade, CascadeClassifier& eyeCascade, CascadeClassifier& eyeGlassCascade,
+                     preprocessWorkspace &workspace, faceTracker *tracker = NULL);
     Mat emitSignal(Mat& img);
 
+    // run the glasses cascade alongside the plain one rather than after it misses, on by default with 4+ cores
+    bool speculativeGlasses;
+    // preprocess the aligned face with facefilters rather than OpenCV, on by default in NEON builds
+    bool fastPreprocess;
+
+private:
+    bool loadEyeCascades(preprocessWorkspace &workspace);
+    void searchEyes(Mat &topLeftFace, Mat &topRightFace, CascadeClassifier &eyeCascade1, CascadeClassifier &eyeCascade2,
+                    preprocessWorkspace &workspace, Rect &leftEyeRect, Rect &rightEyeRect);
+    Rect searchFace(Mat &greyImage, Rect roi, CascadeClassifier &faceCascade, int scaledWidth, preprocessWorkspace &workspace,
+                    framePyramid *pyramid, const detectionSettings &settings, Size minSize = Size(20,20), Size maxSize = Size());
+
 
 
 };
@@ -0,0 +1,193 @@
+#include "enrolmentwriter.h"
+
+#include "opencv2/highgui/highgui.hpp"
+
+#include <iostream>
+#include <stdio.h>
+#include <unistd.h>
+
+using namespace cv;
+using namespace std;
+
+const int SNAPSHOT_COMPRESSION = 3;     //png level, 9 takes several times longer for a few percent on camera frames
+
+enrolmentWriter::enrolmentWriter(detectObject &detection, faceStore &store, int depth)
+    : detection(detection), store(store), jobs(depth)
+{
+    policy = SYNC_BATCH;
+    callback = NULL;
+    context = NULL;
+    nextId = 0;
+    outstanding = 0;
+    workspace.concurrentEyes = false;   //not latency critical, leave the cores to the pipeline
+}
+
+enrolmentWriter::~enrolmentWriter()
+{
+    stop();
+}
+
+/*
+  starts the writer thread
+  @params - policy(when writes are synced); callback(optional, called per finished job); context(passed to callback)
+*/
+void enrolmentWriter::start(syncPolicy policy, writeCallback callback, void *context)
+{
+    stop();
+    this->policy = policy;
+    this->callback = callback;
+    this->context = context;
+    jobs.reopen();
+    QThread::start(QThread::LowPriority);
+}
+
+void enrolmentWriter::stop()
+{
+    if (isRunning()){
+        //the thread drains the queue before it sees the close
+        jobs.close();
+        wait();
+    }
+}
+
+int enrolmentWriter::enrol(const Mat &frame, const string name)
+{
+    return queue(ENROL_WRITE, frame, name);
+}
+
+int enrolmentWriter::snapshot(const Mat &frame, const string filename)
+{
+    return queue(SNAPSHOT_WRITE, frame, filename);
+}
+
+int enrolmentWriter::pending()
+{
+    return (int)outstanding;
+}
+
+/*
+  copies the frame so the caller can hand its buffer straight back, and queues the job
+  @params - kind; frame; name(user or snapshot file)
+  @returns - job id, -1 if the writer isn't running or its queue is full
+*/
+int enrolmentWriter::queue(writeKind kind, const Mat &frame, const string name)
+{
+    if (!isRunning() || frame.empty()){
+        return -1;
+    }
+    writeJob job;
+    job.id = nextId++;
+    job.kind = kind;
+    job.name = name;
+    frame.copyTo(job.frame);
+    job.timer.start();
+    outstanding.ref();
+    if (!jobs.tryPush(job)){
+        outstanding.deref();
+        return -1;
+    }
+    return job.id;
+}
+
+/*
+  writes jobs in order until the queue is closed and empty, enrolments under SYNC_BATCH
+  are held back from the callback until the sync that covers them
+*/
+void enrolmentWriter::run()
+{
+    writeJob job;
+    while (jobs.pop(job)){
+        if (job.kind == ENROL_WRITE){
+            job.written = enrolFace(job);
+        }else{
+            job.written = writeSnapshot(job);
+        }
+        if (job.kind == ENROL_WRITE && job.written && policy == SYNC_BATCH){
+            job.frame.release();
+            unsynced.push_back(job);
+        }else{
+            if (callback != NULL){
+                callback(job, context);
+            }
+            outstanding.deref();
+        }
+        if (!unsynced.empty() && (jobs.size() == 0 || (int)unsynced.size() >= WRITER_SYNC_BATCH)){
+            finishBatch(store.sync());
+        }
+        job = writeJob();
+    }
+    if (!unsynced.empty()){
+        finishBatch(store.sync());
+    }
+}
+
+/*
+  reports the enrolments a sync covered
+  @params - synced(false if the sync failed, the faces are in the store but may not survive a power cut)
+*/
+void enrolmentWriter::finishBatch(bool synced)
+{
+    for (size_t i = 0; i < unsynced.size(); i++){
+        unsynced[i].written = synced;
+        if (callback != NULL){
+            callback(unsynced[i], context);
+        }
+        outstanding.deref();
+    }
+    unsynced.clear();
+}
+
+/*
+  preprocesses the frame and appends the face to the store, the cascades are loaded on the first enrolment
+  @params - job
+  @returns - true if the face was stored
+*/
+bool enrolmentWriter::enrolFace(writeJob &job)
+{
+    if (faceCascade.empty()){
+        detection.initCascades(faceCascade, eyeCascade, eyeGlassCascade);
+        if (faceCascade.empty() || eyeCascade.empty() || eyeGlassCascade.empty()){
+            return false;
+        }
+    }
+    Mat face = detection.processImage(job.frame, faceCascade, eyeCascade, eyeGlassCascade, workspace);
+    if (face.empty()){
+        cout << "No face detected, " << job.name << " not enrolled" << endl;
+        return false;
+    }
+    return store.append(job.name, face, 0, policy == SYNC_EVERY_WRITE);
+}
+
+/*
+  encodes the frame as png and writes it through a temporary file, so a snapshot is either whole or missing
+  @params - job
+  @returns - true if the file was written
+*/
+bool enrolmentWriter::writeSnapshot(writeJob &job)
+{
+    vector<int> params;
+    params.push_back(CV_IMWRITE_PNG_COMPRESSION);
+    params.push_back(SNAPSHOT_COMPRESSION);
+    try{
+        imencode(".png", job.frame, encoded, params);
+    }catch(cv::Exception &e){
+        fprintf(stderr, "Could not encode snapshot %s: %s\n", job.name.c_str(), e.what());
+        return false;
+    }
+
+    string tmpName = job.name + ".tmp";
+    FILE *file = fopen(tmpName.c_str(), "wb");
+    if (file == NULL){
+        fprintf(stderr, "Could not write snapshot: %s\n", tmpName.c_str());
+        return false;
+    }
+    bool ok = fwrite(&encoded[0], 1, encoded.size(), file) == encoded.size();
+    ok = ok && fflush(file) == 0 && (policy == SYNC_NEVER || fsync(fileno(file)) == 0);
+    ok = (fclose(file) == 0) && ok;
+    if (!ok || rename(tmpName.c_str(), job.name.c_str()) != 0){
+        fprintf(stderr, "Could not write snapshot: %s\n", job.name.c_str());
+        remove(tmpName.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,96 @@
+#ifndef ENROLMENTWRITER_H
+#define ENROLMENTWRITER_H
+
+#include <QThread>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/objdetect/objdetect.hpp"
+
+#include "boundedqueue.h"
+#include "detectobject.h"
+#include "facestore.h"
+
+#include <string>
+#include <vector>
+
+using namespace cv;
+using namespace std;
+
+enum writeKind { ENROL_WRITE, SNAPSHOT_WRITE };
+
+/*
+  When writes reach the disk. SYNC_BATCH syncs the store once the queue runs empty (or every
+  WRITER_SYNC_BATCH enrolments) and reports the whole batch after it, snapshots are synced one by one.
+  SYNC_NEVER leaves it to the kernel.
+*/
+enum syncPolicy { SYNC_EVERY_WRITE, SYNC_BATCH, SYNC_NEVER };
+
+const int WRITER_SYNC_BATCH = 8;    // at most this many enrolments unsynced, must be <= STORE_TAIL_CHECK
+
+// One queued write, handed back to the completion callback.
+struct writeJob
+{
+    int id;
+    writeKind kind;
+    string name;            // user to enrol, or snapshot file
+    Mat frame;              // copy of the camera frame, owned by the job
+    bool written;           // true once it is on disk as the sync policy requires
+    QElapsedTimer timer;    // started when the job was queued
+
+    writeJob() : id(-1), kind(ENROL_WRITE), written(false) {}
+};
+
+// Called on the writer thread once a job is finished, written or not.
+typedef void (*writeCallback)(const writeJob &job, void *context);
+
+/*
+  Preprocesses enrolment frames into the face store and encodes snapshots on its own thread,
+  so the camera loop only copies the frame. The queue is bounded, a full queue refuses the
+  frame rather than blocking the caller. Once started, the store must only be appended to here.
+*/
+class enrolmentWriter : public QThread
+{
+public:
+    enrolmentWriter(detectObject &detection, faceStore &store, int depth);
+    ~enrolmentWriter();
+
+    void start(syncPolicy policy, writeCallback callback = NULL, void *context = NULL);
+    // finishes everything queued, then syncs and stops
+    void stop();
+
+    // copies the frame and queues it, never blocks; returns the job id, -1 if the queue is full
+    int enrol(const Mat &frame, const string name);
+    int snapshot(const Mat &frame, const string filename);
+    // jobs queued or being written
+    int pending();
+
+protected:
+    void run();
+
+private:
+    int queue(writeKind kind, const Mat &frame, const string name);
+    bool enrolFace(writeJob &job);
+    bool writeSnapshot(writeJob &job);
+    void finishBatch(bool synced);
+
+    detectObject &detection;
+    faceStore &store;
+    boundedQueue<writeJob> jobs;
+    syncPolicy policy;
+    writeCallback callback;
+    void *context;
+    int nextId;                     // caller thread only
+    QAtomicInt outstanding;
+
+    //writer thread only
+    CascadeClassifier faceCascade;
+    CascadeClassifier eyeCascade;
+    CascadeClassifier eyeGlassCascade;
+    preprocessWorkspace workspace;
+    vector<uchar> encoded;
+    vector<writeJob> unsynced;      // enrolments written but not yet synced
+};
+
+#endif // ENROLMENTWRITER_H
@@ -0,0 +1,223 @@
+#include "facefilters.h"
+
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "simdkernels.h"
+
+#include <math.h>
+#include <string.h>
+
+using namespace cv;
+using namespace std;
+
+const int INTER_FRACTION_BITS = 5;      // warpAffine's INTER_BITS, sub pixel positions are 1/32 pixel
+const int COORD_BITS = 10;              // warpAffine's AB_BITS, fixed point of the mapped coordinates
+const int WARP_WIDTH_LIMIT = 512;       // widest face warpFace handles without allocating
+
+bilateralTables::bilateralTables()
+{
+    radius = 0;
+    step = 0;
+    sigmaColor = 0;
+    sigmaSpace = 0;
+}
+
+/*
+  same window and weights as bilateralFilter with d = 0: the radius comes from sigmaSpace and
+  the taps are every offset within it, in the same order so the sums round the same way
+  @params - step(of the padded image); sigmaColor; sigmaSpace
+*/
+void bilateralTables::prepare(int step, double sigmaColor, double sigmaSpace)
+{
+    if (step == this->step && sigmaColor == this->sigmaColor && sigmaSpace == this->sigmaSpace){
+        return;
+    }
+    this->step = step;
+    this->sigmaColor = sigmaColor;
+    this->sigmaSpace = sigmaSpace;
+
+    double colourSigma = sigmaColor > 0 ? sigmaColor : 1;
+    double spaceSigma = sigmaSpace > 0 ? sigmaSpace : 1;
+    double colourCoeff = -0.5 / (colourSigma * colourSigma);
+    double spaceCoeff = -0.5 / (spaceSigma * spaceSigma);
+    radius = max(cvRound(spaceSigma * 1.5), 1);
+
+    colour.resize(256);
+    for (int i = 0; i < 256; i++){
+        colour[i] = (float)exp(i * i * colourCoeff);
+    }
+    space.clear();
+    offsets.clear();
+    for (int i = -radius; i <= radius; i++){
+        for (int j = -radius; j <= radius; j++){
+            double r = sqrt((double)i * i + (double)j * j);
+            if (r > radius){
+                continue;
+            }
+            space.push_back((float)exp(r * r * spaceCoeff));
+            offsets.push_back(i * step + j);
+        }
+    }
+}
+
+/*
+  bilinear warp in warpAffine's fixed point: the inverse map is stepped in 1/1024 pixel units and
+  cut to 1/32 pixel, the four weights are products of the 1/32 fractions and source pixels
+  outside the image count as black. Differs from warpAffine by at most 1 where its rounded
+  weight tables don't sum exactly
+  @params - src(face image); dst(out, allocated to the output size); transform(2x3 CV_64F, src to dst)
+*/
+void warpFace(const Mat &src, Mat &dst, const Mat &transform)
+{
+    //dst pixels are mapped back into src, invert the transform as warpAffine does
+    double m[6];
+    for (int i = 0; i < 3; i++){
+        m[i] = transform.at<double>(0, i);
+        m[i + 3] = transform.at<double>(1, i);
+    }
+    double d = m[0]*m[4] - m[1]*m[3];
+    d = d != 0 ? 1./d : 0;
+    double a11 = m[4]*d, a22 = m[0]*d;
+    m[0] = a11; m[1] *= -d;
+    m[3] *= -d; m[4] = a22;
+    double b1 = -m[0]*m[2] - m[1]*m[5];
+    double b2 = -m[3]*m[2] - m[4]*m[5];
+    m[2] = b1; m[5] = b2;
+
+    const int scale = 1 << COORD_BITS;
+    const int roundDelta = scale / (1 << INTER_FRACTION_BITS) / 2;
+    const int one = 1 << INTER_FRACTION_BITS;
+    const int fraction = one - 1;
+    const int shift = 2 * INTER_FRACTION_BITS;
+
+    int width = dst.cols;
+    AutoBuffer<int, 2*WARP_WIDTH_LIMIT> deltas(2*width);
+    int *xDelta = deltas;
+    int *yDelta = xDelta + width;
+    for (int x = 0; x < width; x++){
+        xDelta[x] = saturate_cast<int>(m[0]*x*scale);
+        yDelta[x] = saturate_cast<int>(m[3]*x*scale);
+    }
+
+    int lastX = src.cols - 1;
+    int lastY = src.rows - 1;
+    size_t step = src.step;
+    for (int y = 0; y < dst.rows; y++){
+        int x0 = saturate_cast<int>((m[1]*y + m[2])*scale) + roundDelta;
+        int y0 = saturate_cast<int>((m[4]*y + m[5])*scale) + roundDelta;
+        uchar *out = dst.ptr<uchar>(y);
+        for (int x = 0; x < width; x++){
+            int mappedX = (x0 + xDelta[x]) >> (COORD_BITS - INTER_FRACTION_BITS);
+            int mappedY = (y0 + yDelta[x]) >> (COORD_BITS - INTER_FRACTION_BITS);
+            int sx = mappedX >> INTER_FRACTION_BITS;
+            int sy = mappedY >> INTER_FRACTION_BITS;
+            int fx = mappedX & fraction;
+            int fy = mappedY & fraction;
+
+            int v00, v01, v10, v11;
+            if ((unsigned)sx < (unsigned)lastX && (unsigned)sy < (unsigned)lastY){
+                const uchar *p = src.ptr<uchar>(sy) + sx;
+                v00 = p[0];
+                v01 = p[1];
+                v10 = p[step];
+                v11 = p[step + 1];
+            }else{
+                //border, anything outside the face is black
+                bool left = sx >= 0 && sx <= lastX;
+                bool right = sx + 1 >= 0 && sx + 1 <= lastX;
+                bool top = sy >= 0 && sy <= lastY;
+                bool bottom = sy + 1 >= 0 && sy + 1 <= lastY;
+                v00 = (top && left) ? src.at<uchar>(sy, sx) : 0;
+                v01 = (top && right) ? src.at<uchar>(sy, sx + 1) : 0;
+                v10 = (bottom && left) ? src.at<uchar>(sy + 1, sx) : 0;
+                v11 = (bottom && right) ? src.at<uchar>(sy + 1, sx + 1) : 0;
+            }
+            int sum = (v00*(one - fx) + v01*fx)*(one - fy) + (v10*(one - fx) + v11*fx)*fy;
+            out[x] = (uchar)((sum + (1 << (shift - 1))) >> shift);
+        }
+    }
+}
+
+/*
+  histogram equalisation with equalizeHist's lookup table, so the result is identical
+  the histogram is counted into 4 tables so consecutive equal pixels don't stall on one counter
+  @params - src; dst(out, may be src)
+*/
+void equalizeFace(const Mat &src, Mat &dst)
+{
+    dst.create(src.size(), CV_8U);
+    int counts[4][256];
+    memset(counts, 0, sizeof(counts));
+    for (int y = 0; y < src.rows; y++){
+        const uchar *row = src.ptr<uchar>(y);
+        int x = 0;
+        for (; x + 4 <= src.cols; x += 4){
+            counts[0][row[x]]++;
+            counts[1][row[x + 1]]++;
+            counts[2][row[x + 2]]++;
+            counts[3][row[x + 3]]++;
+        }
+        for (; x < src.cols; x++){
+            counts[0][row[x]]++;
+        }
+    }
+    int hist[256];
+    for (int i = 0; i < 256; i++){
+        hist[i] = counts[0][i] + counts[1][i] + counts[2][i] + counts[3][i];
+    }
+
+    int total = src.rows * src.cols;
+    if (total == 0){
+        return;
+    }
+    int i = 0;
+    while (!hist[i]){
+        ++i;
+    }
+    if (hist[i] == total){
+        dst.setTo(i);
+        return;
+    }
+    uchar lut[256];
+    float scale = 255.f / (total - hist[i]);
+    int sum = 0;
+    for (lut[i++] = 0; i < 256; ++i){
+        sum += hist[i];
+        lut[i] = saturate_cast<uchar>(sum * scale);
+    }
+
+    for (int y = 0; y < src.rows; y++){
+        const uchar *row = src.ptr<uchar>(y);
+        uchar *out = dst.ptr<uchar>(y);
+        for (int x = 0; x < src.cols; x++){
+            out[x] = lut[row[x]];
+        }
+    }
+}
+
+/*
+  bilateral filter over a reflected border like bilateralFilter, the window is walked with
+  bilateralRow which filters 8 pixels per pass with NEON/SSE2
+  @params - src; dst(out, not src); padded(scratch); tables; sigmaColor; sigmaSpace
+*/
+void bilateralFace(const Mat &src, Mat &dst, Mat &padded, bilateralTables &tables, double sigmaColor, double sigmaSpace)
+{
+    int radius = max(cvRound((sigmaSpace > 0 ? sigmaSpace : 1) * 1.5), 1);
+    copyMakeBorder(src, padded, radius, radius, radius, radius, BORDER_DEFAULT);
+    tables.prepare((int)padded.step, sigmaColor, sigmaSpace);
+
+    dst.create(src.size(), CV_8U);
+    int taps = (int)tables.offsets.size();
+    for (int y = 0; y < src.rows; y++){
+        bilateralRow(padded.ptr<uchar>(y + radius) + radius, &tables.offsets[0], &tables.space[0], taps,
+                     &tables.colour[0], dst.ptr<uchar>(y), src.cols);
+    }
+}
+
+void maskFace(const Mat &src, const Mat &mask, uchar fill, Mat &dst)
+{
+    dst.create(src.size(), CV_8U);
+    for (int y = 0; y < src.rows; y++){
+        maskRow(src.ptr<uchar>(y), mask.ptr<uchar>(y), fill, dst.ptr<uchar>(y), src.cols);
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef FACEFILTERS_H
+#define FACEFILTERS_H
+
+#include "opencv2/core/core.hpp"
+
+#include <vector>
+
+using namespace cv;
+
+/*
+  Replacements for the OpenCV calls detectEyes makes on the small aligned face, written for
+  the IMX6 where OpenCV has no NEON paths for them. Each gives the same result as its OpenCV
+  call to within FACE_FILTER_TOLERANCE grey levels, benchmark --verify checks that.
+*/
+
+const int FACE_FILTER_TOLERANCE = 1;
+
+// Window taps and weights of bilateralFilter, built once for the padded face image.
+struct bilateralTables
+{
+    bilateralTables();
+    // rebuilds the tables if the padded step or the sigmas changed
+    void prepare(int step, double sigmaColor, double sigmaSpace);
+
+    int radius;
+    int step;
+    double sigmaColor;
+    double sigmaSpace;
+    std::vector<float> colour;      // weight per absolute grey level difference
+    std::vector<float> space;       // weight per tap
+    std::vector<int> offsets;       // per tap, bytes from the centre pixel
+};
+
+// warpAffine(src, dst, transform, dst.size()), bilinear with a black border, dst must already be allocated.
+void warpFace(const Mat &src, Mat &dst, const Mat &transform);
+// equalizeHist(src, dst), may be in place.
+void equalizeFace(const Mat &src, Mat &dst);
+// bilateralFilter(src, dst, 0, sigmaColor, sigmaSpace), padded is scratch for the bordered copy.
+void bilateralFace(const Mat &src, Mat &dst, Mat &padded, bilateralTables &tables, double sigmaColor, double sigmaSpace);
+// dst.setTo(fill); src.copyTo(dst, mask)
+void maskFace(const Mat &src, const Mat &mask, uchar fill, Mat &dst);
+
+#endif // FACEFILTERS_H
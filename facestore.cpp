@@ -0,0 +1,479 @@
+#include "facestore.h"
+
+#include "opencv2/highgui/highgui.hpp"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QStringList>
+
+#include <algorithm>
+#include <iostream>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace cv;
+using namespace std;
+
+//store file layout: header, then fixed size records of a record header and the raw face pixels
+const char STORE_MAGIC[8] = {'F', 'R', 'S', 'T', 'O', 'R', 'E', '1'};
+const int32_t STORE_VERSION = 1;
+const size_t STORE_HEADER_SIZE = 64;
+const uint32_t RECORD_MAGIC = 0x43455246;   // "FREC"
+const int STORE_NAME_LENGTH = 48;           // bytes of name kept, including the terminator
+const size_t RECORD_ALIGN = 64;             // records start on cache lines so the mapped pixels are aligned
+const int STORE_RESERVE = 1024;             // records mapped past the end of the file, appends within it don't remap
+
+//index file layout: the same header with INDEX_MAGIC, then a copy of every record's header in order
+const char INDEX_MAGIC[8] = {'F', 'R', 'I', 'N', 'D', 'E', 'X', '1'};
+const string INDEX_EXT = ".index";
+
+struct storeHeader
+{
+    char magic[8];
+    int32_t version;
+    int32_t width;          // face size every record holds
+    int32_t height;
+    int32_t recordSize;
+    char reserved[40];
+};
+
+struct recordHeader
+{
+    uint32_t magic;
+    uint32_t checksum;      // FNV-1a of everything after it, header and pixels
+    int64_t timestamp;      // enrolment time, seconds since the epoch
+    char name[STORE_NAME_LENGTH];
+};
+
+/*
+  FNV-1a over the record after its magic and checksum
+  @params - record; pixels(bytes of face data)
+  @returns - checksum
+*/
+static uint32_t recordChecksum(const char *record, size_t pixels)
+{
+    const unsigned char *bytes = (const unsigned char*)record + 2 * sizeof(uint32_t);
+    size_t length = sizeof(recordHeader) - 2 * sizeof(uint32_t) + pixels;
+    uint32_t hash = 2166136261U;
+    for (size_t i = 0; i < length; i++){
+        hash = (hash ^ bytes[i]) * 16777619U;
+    }
+    return hash;
+}
+
+faceStore::faceStore()
+{
+    fd = -1;
+    indexFd = -1;
+    width = 0;
+    height = 0;
+    recordSize = 0;
+    count = 0;
+    data = NULL;
+    reserved = 0;
+}
+
+faceStore::~faceStore()
+{
+    close();
+}
+
+/*
+  opens the store, creating it if it doesn't exist, and indexes the records from the index file.
+  Only the records appended since the last sync can be torn by a power cut, so only the last
+  STORE_TAIL_CHECK are read from the store itself and have their checksums checked; the first bad
+  one and everything after it is cut off. Records the index doesn't cover are read from the store
+  and added to it. A bad record before the tail means the file is damaged and it isn't opened
+  @params - filename; faceWidth, faceHeight(size of the faces the store holds)
+  @returns - true if the store is ready
+*/
+bool faceStore::open(const string filename, int faceWidth, int faceHeight)
+{
+    close();
+    this->filename = filename;
+    width = faceWidth;
+    height = faceHeight;
+    recordSize = (sizeof(recordHeader) + (size_t)width * height + RECORD_ALIGN - 1) & ~(RECORD_ALIGN - 1);
+
+    fd = ::open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0){
+        fprintf(stderr, "Could not open face store %s: %s\n", filename.c_str(), strerror(errno));
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0){
+        close();
+        return false;
+    }
+
+    size_t fileSize = info.st_size;
+    storeHeader header;
+    if (fileSize < STORE_HEADER_SIZE){
+        //new, or never completely created
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, STORE_MAGIC, sizeof(header.magic));
+        header.version = STORE_VERSION;
+        header.width = width;
+        header.height = height;
+        header.recordSize = (int32_t)recordSize;
+        if (ftruncate(fd, 0) != 0 || pwrite(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) || fdatasync(fd) != 0){
+            fprintf(stderr, "Could not create face store %s: %s\n", filename.c_str(), strerror(errno));
+            close();
+            return false;
+        }
+        fileSize = STORE_HEADER_SIZE;
+    }else if (pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)
+              || memcmp(header.magic, STORE_MAGIC, sizeof(header.magic)) != 0 || header.version != STORE_VERSION
+              || header.width != width || header.height != height || header.recordSize != (int32_t)recordSize){
+        fprintf(stderr, "%s is not a face store for %dx%d faces\n", filename.c_str(), width, height);
+        close();
+        return false;
+    }
+
+    string indexName = filename + INDEX_EXT;
+    indexFd = ::open(indexName.c_str(), O_RDWR | O_CREAT, 0644);
+    if (indexFd < 0){
+        fprintf(stderr, "Could not open face store index %s: %s\n", indexName.c_str(), strerror(errno));
+        close();
+        return false;
+    }
+
+    int records = (int)((fileSize - STORE_HEADER_SIZE) / recordSize);
+    if (!mapFile(STORE_HEADER_SIZE + records * recordSize)){
+        close();
+        return false;
+    }
+    //the tail is read from the records themselves, everything before it from the index where it has it
+    vector<char> entries;
+    int indexed = readIndex(entries);
+    int trusted = max(0, min(indexed, records - STORE_TAIL_CHECK));
+    for (int i = 0; i < records; i++){
+        const char *header = i < trusted ? &entries[i * sizeof(recordHeader)] : record(i);
+        if (!addRecord(header, i, i >= records - STORE_TAIL_CHECK)){
+            break;
+        }
+    }
+    if (count < records - STORE_TAIL_CHECK){
+        fprintf(stderr, "Face store %s is damaged at record %d\n", filename.c_str(), count);
+        close();
+        return false;
+    }
+
+    size_t valid = STORE_HEADER_SIZE + count * recordSize;
+    if (fileSize != valid){
+        //the last appends didn't complete
+        cout << "Face store " << filename << ": dropped " << fileSize - valid << " bytes of incomplete records" << endl;
+        if (ftruncate(fd, valid) != 0 || fdatasync(fd) != 0){
+            fprintf(stderr, "Could not repair face store %s: %s\n", filename.c_str(), strerror(errno));
+            close();
+            return false;
+        }
+    }
+
+    //entries after the last one that matches its record are rewritten, a new index gets its header and entries
+    //left by an append that was cut off are dropped
+    int matching = trusted;
+    while (matching < min(indexed, count)
+           && memcmp(&entries[matching * sizeof(recordHeader)], record(matching), sizeof(recordHeader)) == 0){
+        matching++;
+    }
+    if (matching < count || indexed != count){
+        if (!writeIndex(matching)){
+            fprintf(stderr, "Could not write face store index %s: %s\n", indexName.c_str(), strerror(errno));
+            close();
+            return false;
+        }
+        if (count - matching > STORE_TAIL_CHECK){
+            cout << "Face store " << filename << ": indexed " << count - matching << " records" << endl;
+        }
+    }
+    return true;
+}
+
+/*
+  reads the index entries that can be used: the file must match the store and entries stop at the first bad one
+  @params - entries(out, the entries read)
+  @returns - number of usable entries, -1 if the index is new or doesn't belong to the store
+*/
+int faceStore::readIndex(vector<char> &entries)
+{
+    struct stat info;
+    storeHeader header;
+    if (fstat(indexFd, &info) != 0 || (size_t)info.st_size < STORE_HEADER_SIZE
+            || pread(indexFd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)
+            || memcmp(header.magic, INDEX_MAGIC, sizeof(header.magic)) != 0 || header.version != STORE_VERSION
+            || header.width != width || header.height != height || header.recordSize != (int32_t)recordSize){
+        return -1;
+    }
+    int available = (int)((info.st_size - STORE_HEADER_SIZE) / sizeof(recordHeader));
+    if (available <= 0){
+        return 0;
+    }
+    entries.resize(available * sizeof(recordHeader));
+    if (pread(indexFd, &entries[0], entries.size(), STORE_HEADER_SIZE) != (ssize_t)entries.size()){
+        return -1;
+    }
+    int valid = 0;
+    while (valid < available && ((const recordHeader*)&entries[valid * sizeof(recordHeader)])->magic == RECORD_MAGIC){
+        valid++;
+    }
+    return valid;
+}
+
+/*
+  rewrites the index from entry from onwards out of the record headers, and cuts it to count entries
+  @params - from(first entry to write)
+  @returns - false if it couldn't be written
+*/
+bool faceStore::writeIndex(int from)
+{
+    storeHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+    header.version = STORE_VERSION;
+    header.width = width;
+    header.height = height;
+    header.recordSize = (int32_t)recordSize;
+
+    vector<char> entries((count - from) * sizeof(recordHeader));
+    for (int i = from; i < count; i++){
+        memcpy(&entries[(i - from) * sizeof(recordHeader)], record(i), sizeof(recordHeader));
+    }
+    off_t offset = STORE_HEADER_SIZE + from * sizeof(recordHeader);
+    return pwrite(indexFd, &header, sizeof(header), 0) == (ssize_t)sizeof(header)
+            && (entries.empty() || pwrite(indexFd, &entries[0], entries.size(), offset) == (ssize_t)entries.size())
+            && ftruncate(indexFd, STORE_HEADER_SIZE + count * sizeof(recordHeader)) == 0 && fdatasync(indexFd) == 0;
+}
+
+void faceStore::close()
+{
+    if (data != NULL){
+        munmap((void*)data, reserved);
+        data = NULL;
+        reserved = 0;
+    }
+    for (size_t i = 0; i < oldMappings.size(); i++){
+        munmap(oldMappings[i].first, oldMappings[i].second);
+    }
+    oldMappings.clear();
+    if (fd >= 0){
+        ::close(fd);
+        fd = -1;
+    }
+    if (indexFd >= 0){
+        ::close(indexFd);
+        indexFd = -1;
+    }
+    count = 0;
+    labels.clear();
+    timestamps.clear();
+    checksums.clear();
+    labelNames.clear();
+    labelOf.clear();
+}
+
+/*
+  maps the file with room for STORE_RESERVE more records, the pages past the end of the file
+  become readable as appends extend it. The previous mapping is kept for faces already handed out
+  @params - fileSize
+  @returns - false if the file couldn't be mapped
+*/
+bool faceStore::mapFile(size_t fileSize)
+{
+    size_t length = fileSize + STORE_RESERVE * recordSize;
+    void *mapping = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED){
+        fprintf(stderr, "Could not map face store %s: %s\n", filename.c_str(), strerror(errno));
+        return false;
+    }
+    if (data != NULL){
+        oldMappings.push_back(make_pair((void*)data, reserved));
+    }
+    data = (const char*)mapping;
+    reserved = length;
+    return true;
+}
+
+/*
+  adds a record to the in memory index
+  @params - header(the record's header, from the index file, the mapping or an append);
+            index; verify(check the record in the mapping against the header's checksum)
+  @returns - false if the record isn't valid
+*/
+bool faceStore::addRecord(const char *header, int index, bool verify)
+{
+    const recordHeader *entry = (const recordHeader*)header;
+    if (entry->magic != RECORD_MAGIC || (verify && entry->checksum != recordChecksum(record(index), (size_t)width * height))){
+        return false;
+    }
+    string user(entry->name, strnlen(entry->name, STORE_NAME_LENGTH));
+    map<string, int>::iterator found = labelOf.find(user);
+    if (found == labelOf.end()){
+        found = labelOf.insert(make_pair(user, (int)labelNames.size())).first;
+        labelNames.push_back(user);
+    }
+    labels.push_back(found->second);
+    timestamps.push_back(entry->timestamp);
+    checksums.push_back(entry->checksum);
+    count = index + 1;
+    return true;
+}
+
+const char *faceStore::record(int index) const
+{
+    return data + STORE_HEADER_SIZE + index * recordSize;
+}
+
+/*
+  writes the record past the last one and its index entry and syncs both before it is indexed,
+  a failed write is cut off again
+  @params - name(user, truncated to STORE_NAME_LENGTH - 1); face(width x height CV_8U); timestamp(0 for now);
+            sync(false to leave the fdatasync to a later sync())
+  @returns - true once the face is on disk
+*/
+bool faceStore::append(const string name, const Mat &face, int64_t timestamp, bool sync)
+{
+    if (fd < 0){
+        return false;
+    }
+    if (face.rows != height || face.cols != width || face.type() != CV_8U){
+        fprintf(stderr, "Face store %s only holds %dx%d grayscale faces\n", filename.c_str(), width, height);
+        return false;
+    }
+
+    buffer.assign(recordSize, 0);
+    recordHeader *header = (recordHeader*)&buffer[0];
+    header->magic = RECORD_MAGIC;
+    header->timestamp = timestamp != 0 ? timestamp : (int64_t)time(NULL);
+    strncpy(header->name, name.c_str(), STORE_NAME_LENGTH - 1);
+    char *pixels = &buffer[sizeof(recordHeader)];
+    for (int y = 0; y < height; y++){
+        memcpy(pixels + y * width, face.ptr<uchar>(y), width);
+    }
+    header->checksum = recordChecksum(&buffer[0], (size_t)width * height);
+
+    off_t offset = STORE_HEADER_SIZE + count * recordSize;
+    off_t indexOffset = STORE_HEADER_SIZE + count * sizeof(recordHeader);
+    if (pwrite(fd, &buffer[0], recordSize, offset) != (ssize_t)recordSize
+            || pwrite(indexFd, &buffer[0], sizeof(recordHeader), indexOffset) != (ssize_t)sizeof(recordHeader)
+            || (sync && (fdatasync(fd) != 0 || fdatasync(indexFd) != 0))){
+        fprintf(stderr, "Could not append to face store %s: %s\n", filename.c_str(), strerror(errno));
+        if (ftruncate(fd, offset) != 0 || ftruncate(indexFd, indexOffset) != 0){
+            fprintf(stderr, "Could not cut off the failed append, it is dropped on the next open\n");
+        }
+        return false;
+    }
+    if ((size_t)offset + recordSize > reserved && !mapFile((size_t)offset + recordSize)){
+        //on disk but not mapped, it is indexed on the next open
+        return false;
+    }
+    addRecord(&buffer[0], count, false);
+    return true;
+}
+
+bool faceStore::sync()
+{
+    if (fd < 0 || fdatasync(fd) != 0 || fdatasync(indexFd) != 0){
+        fprintf(stderr, "Could not sync face store %s: %s\n", filename.c_str(), strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+/*
+  appends every png in dir that is a preprocessed face, named after the file and stamped with its modification time
+  @params - dir(with trailing separator)
+  @returns - faces imported
+*/
+int faceStore::import(const string dir)
+{
+    QDir imageDir(QString::fromStdString(dir));
+    QStringList files = imageDir.entryList(QStringList() << "*.png", QDir::Files, QDir::Name);
+    int imported = 0;
+    for (int i = 0; i < files.size(); i++){
+        string path = dir + files[i].toStdString();
+        Mat face;
+        try{
+            face = imread(path, 0);
+        }catch(cv::Exception &e){}
+        if (face.rows != height || face.cols != width){
+            cout << "Not importing " << path << ", not a preprocessed face" << endl;
+            continue;
+        }
+        struct stat info;
+        int64_t modified = stat(path.c_str(), &info) == 0 ? (int64_t)info.st_mtime : 0;
+        //synced in batches, no more than STORE_TAIL_CHECK records are ever unsynced
+        bool batchEnd = (imported + 1) % STORE_TAIL_CHECK == 0;
+        if (append(QFileInfo(files[i]).completeBaseName().toStdString(), face, modified, batchEnd)){
+            imported++;
+        }
+    }
+    if (imported > 0 && !sync()){
+        return 0;
+    }
+    if (imported > 0){
+        cout << "Imported " << imported << " faces from " << dir << " into " << filename << endl;
+    }
+    return imported;
+}
+
+Mat faceStore::face(int index) const
+{
+    return Mat(height, width, CV_8U, (void*)(record(index) + sizeof(recordHeader)));
+}
+
+string faceStore::name(int index) const
+{
+    return labelNames[labels[index]];
+}
+
+int64_t faceStore::timestamp(int index) const
+{
+    return timestamps[index];
+}
+
+vector<int> faceStore::find(const string name) const
+{
+    vector<int> faces;
+    map<string, int>::const_iterator found = labelOf.find(name);
+    if (found != labelOf.end()){
+        for (int i = 0; i < count; i++){
+            if (labels[i] == found->second){
+                faces.push_back(i);
+            }
+        }
+    }
+    return faces;
+}
+
+/*
+  FNV-1a of the position, time and checksum of each face, any enrolment changes it
+  @params - name(user, "" for every face)
+  @returns - fingerprint
+*/
+uint64_t faceStore::stamp(const string name) const
+{
+    vector<int> faces;
+    if (name.empty()){
+        for (int i = 0; i < count; i++){
+            faces.push_back(i);
+        }
+    }else{
+        faces = find(name);
+    }
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < faces.size(); i++){
+        int64_t fields[3] = {faces[i], timestamps[faces[i]], checksums[faces[i]]};
+        const unsigned char *bytes = (const unsigned char*)fields;
+        for (size_t j = 0; j < sizeof(fields); j++){
+            hash = (hash ^ bytes[j]) * 1099511628211ULL;
+        }
+    }
+    return hash;
+}
@@ -0,0 +1,84 @@
+#ifndef FACESTORE_H
+#define FACESTORE_H
+
+#include "opencv2/core/core.hpp"
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace cv;
+using namespace std;
+
+/*
+  Every enrolled face in one append-only file of raw preprocessed faces, memory-mapped so
+  loading the gallery decodes nothing. Each record's header (name, timestamp, checksum) is
+  also appended to a compact index file beside the store, so opening reads the index and
+  only the last STORE_TAIL_CHECK records, not every ~5KB record. A store without an index
+  is scanned once and the index written.
+  An append is one write followed by fdatasync, a power cut can only tear the last record
+  and that record is dropped the next time the store is opened. Appends can leave the sync
+  to a later sync() instead, up to STORE_TAIL_CHECK records may then be torn.
+*/
+const int STORE_TAIL_CHECK = 16;    // records at the end whose checksums are checked on open
+
+class faceStore
+{
+public:
+    faceStore();
+    ~faceStore();
+
+    // opens or creates the store for faces of the given size, false if it can't be used
+    bool open(const string filename, int faceWidth, int faceHeight);
+    void close();
+    bool isOpen() const { return fd >= 0; }
+    const string &path() const { return filename; }
+
+    // adds one preprocessed face, timestamp 0 = now; durable once this returns true unless sync is false
+    bool append(const string name, const Mat &face, int64_t timestamp = 0, bool sync = true);
+    // makes every append so far durable
+    bool sync();
+    // appends every preprocessed face png in dir, for moving a gallery of images into the store
+    int import(const string dir);
+
+    int size() const { return count; }
+    // view into the mapping, valid until close()
+    Mat face(int index) const;
+    string name(int index) const;
+    int64_t timestamp(int index) const;
+    // one label per user, in order of first enrolment
+    int label(int index) const { return labels[index]; }
+    const vector<string> &names() const { return labelNames; }
+    // faces of one user, oldest first
+    vector<int> find(const string name) const;
+    // fingerprint of the faces of one user, or of every face if name is empty, for the saved models
+    uint64_t stamp(const string name = "") const;
+
+private:
+    bool mapFile(size_t fileSize);
+    int readIndex(vector<char> &entries);
+    bool writeIndex(int from);
+    bool addRecord(const char *header, int index, bool verify);
+    const char *record(int index) const;
+
+    int fd;
+    int indexFd;                // name, timestamp and checksum of every record, appended with it
+    string filename;
+    int width;
+    int height;
+    size_t recordSize;
+    int count;
+    const char *data;           // current mapping, covers reserved bytes
+    size_t reserved;
+    vector<pair<void*, size_t> > oldMappings;   // kept until close, faces handed out may point into them
+
+    vector<int> labels;
+    vector<int64_t> timestamps;
+    vector<uint32_t> checksums;
+    vector<string> labelNames;
+    map<string, int> labelOf;
+    vector<char> buffer;        // record being appended
+};
+
+#endif // FACESTORE_H
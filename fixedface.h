@@ -0,0 +1,78 @@
+#ifndef FIXEDFACE_H
+#define FIXEDFACE_H
+
+#include "opencv2/core/core.hpp"
+
+#include "simdkernels.h"
+
+#include <string.h>
+
+using namespace cv;
+
+// Draws the face ellipse (255 inside, 0 outside) into a square CV_8U mask, defined in detectobject.cpp.
+void drawFaceMask(Mat &mask);
+
+// Mask and per pixel blend weights of a Width x Width face.
+template <int Width>
+struct fixedFaceTables
+{
+    fixedFaceTables()
+    {
+        Mat maskImage(Width, Width, CV_8U, mask);
+        drawFaceMask(maskImage);
+        halvesBlendWeights(Width, blend);
+        for (int y = 1; y < Width; y++){
+            memcpy(blend + y * Width, blend, Width * sizeof(ushort));
+        }
+    }
+
+    uchar mask[Width * Width];
+    ushort blend[Width * Width];    // the column weights repeated for every row
+};
+
+/*
+  The per face kernels of detectEyes for an output face size fixed at compile time.
+  The tables are built once per size for the whole process rather than per workspace, and
+  a continuous face is processed as one Width * Width row through the inline kernels
+  instantiated for that length, so the loop counts and the scalar tail are fixed at compile time.
+*/
+template <int Width>
+class fixedFace
+{
+public:
+    static const int PIXELS = Width * Width;
+
+    static const fixedFaceTables<Width> &tables()
+    {
+        //built on first use, function statics are initialised once even with concurrent callers
+        static const fixedFaceTables<Width> instance;
+        return instance;
+    }
+
+    // true if image can go through these kernels
+    static bool fits(const Mat &image)
+    {
+        return image.rows == Width && image.cols == Width && image.type() == CV_8U && image.isContinuous();
+    }
+
+    // header on the shared mask, read only
+    static Mat mask()
+    {
+        return Mat(Width, Width, CV_8U, (void*)tables().mask);
+    }
+
+    // blend step of equalizeLeftAndRightHalves, face holds the equalised halves, whole the equalised face
+    static void blend(Mat &face, const Mat &whole)
+    {
+        blendFixed<PIXELS>(face.data, whole.data, tables().blend, face.data);
+    }
+
+    // dst = fill outside the face ellipse, src inside
+    static void applyMask(const Mat &src, uchar fill, Mat &dst)
+    {
+        dst.create(Width, Width, CV_8U);
+        maskFixed<PIXELS>(src.data, tables().mask, fill, dst.data);
+    }
+};
+
+#endif // FIXEDFACE_H
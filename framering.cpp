@@ -0,0 +1,110 @@
+#include "framering.h"
+
+frameRing::frameRing(int size)
+{
+    capacity = size < 2 ? 2 : size;
+    slots = new frameSlot[capacity];
+    for (int i = 0; i < capacity; i++){
+        slots[i].sequence = -1;
+        slots[i].state = 0;
+    }
+    cursor = 0;
+    latest = -1;
+    published = 0;
+    skipped = 0;
+}
+
+frameRing::~frameRing()
+{
+    delete [] slots;
+}
+
+/*
+  claims the next slot that no reader holds, the newest frame is never overwritten
+  so readers always have something to take
+  @returns - slot index, -1 if all slots are pinned (frame dropped)
+*/
+int frameRing::beginWrite()
+{
+    int newest = latest.fetchAndAddOrdered(0);
+    for (int i = 0; i < capacity; i++){
+        int slot = (cursor + i) % capacity;
+        if (slot == newest){
+            continue;
+        }
+        //0 readers -> owned by the producer, fails if a reader got there first
+        if (slots[slot].state.testAndSetOrdered(0, -1)){
+            cursor = (slot + 1) % capacity;
+            return slot;
+        }
+    }
+    skipped.fetchAndAddOrdered(1);
+    return -1;
+}
+
+Mat &frameRing::slotImage(int slot)
+{
+    return slots[slot].image;
+}
+
+/*
+  releases a slot claimed with beginWrite
+  @params - slot; publish(true if the slot now holds a complete frame)
+*/
+void frameRing::endWrite(int slot, bool publish)
+{
+    if (publish){
+        slots[slot].sequence = published.fetchAndAddOrdered(1) + 1;
+    }else{
+        slots[slot].sequence = -1;
+    }
+    slots[slot].state.fetchAndStoreOrdered(0);
+    if (publish){
+        latest.fetchAndStoreOrdered(slot);
+    }
+}
+
+/*
+  pins the newest frame so the producer leaves it alone until release
+  if the producer recycles the slot between reading latest and pinning it
+  the slot either holds a newer complete frame or is marked failed and we retry
+  @params - frame(out, header onto the slot image); sequence(out, frame number)
+  @returns - slot to pass to release, -1 if no frame captured yet
+*/
+int frameRing::acquireLatest(Mat &frame, int &sequence)
+{
+    while (true){
+        int slot = latest.fetchAndAddOrdered(0);
+        if (slot < 0){
+            return -1;
+        }
+        int state = slots[slot].state;
+        if (state < 0 || !slots[slot].state.testAndSetOrdered(state, state + 1)){
+            continue;   //being written or another reader raced us
+        }
+        if (slots[slot].sequence < 0){
+            release(slot);
+            continue;
+        }
+        frame = slots[slot].image;
+        sequence = slots[slot].sequence;
+        return slot;
+    }
+}
+
+void frameRing::release(int slot)
+{
+    if (slot >= 0){
+        slots[slot].state.fetchAndAddOrdered(-1);
+    }
+}
+
+int frameRing::latestSequence()
+{
+    return published.fetchAndAddOrdered(0);
+}
+
+int frameRing::dropped()
+{
+    return skipped.fetchAndAddOrdered(0);
+}
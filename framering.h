@@ -0,0 +1,55 @@
+#ifndef FRAMERING_H
+#define FRAMERING_H
+
+#include <QAtomicInt>
+
+#include "opencv2/core/core.hpp"
+
+using namespace cv;
+
+/*
+  Fixed set of preallocated frame slots shared between one capture thread and any number of readers.
+  The producer writes into a slot no reader holds and then publishes it as the latest frame;
+  readers pin the latest slot and read it in place, nothing is copied and no locks are taken.
+  A slot's state is the number of readers holding it, or -1 while the producer is writing it.
+*/
+class frameRing
+{
+public:
+    explicit frameRing(int size = 8);
+    ~frameRing();
+
+    // producer: claim a free slot to capture into, -1 if every slot is pinned by readers
+    int beginWrite();
+    Mat &slotImage(int slot);
+    // producer: hand the slot back, publishing it as the latest frame if the capture succeeded
+    void endWrite(int slot, bool publish);
+
+    // reader: pin the newest frame, frame becomes a header onto the slot, -1 if nothing captured yet
+    int acquireLatest(Mat &frame, int &sequence);
+    // reader: unpin, the frame header must not be used afterwards as the slot will be overwritten
+    void release(int slot);
+
+    int latestSequence();
+    int dropped();
+
+private:
+    struct frameSlot
+    {
+        Mat image;
+        int sequence;       // frame number, -1 if the last capture into the slot failed
+        QAtomicInt state;
+    };
+
+    frameSlot *slots;
+    int capacity;
+    int cursor;             // producer only, next slot to try
+    QAtomicInt latest;      // slot holding the newest published frame
+    QAtomicInt published;   // number of frames published
+    QAtomicInt skipped;     // frames lost because every slot was pinned
+
+    frameRing(const frameRing&);
+    frameRing &operator=(const frameRing&);
+};
+
+#endif // FRAMERING_H
@@ -0,0 +1,202 @@
+#include "gallery.h"
+
+#include "opencv2/opencv.hpp"
+
+#include <iostream>
+#include <cfloat>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+using namespace cv;
+using namespace std;
+
+const int PARTIAL_BLOCK = 8;    // floats summed between checks of the partial distance, two SIMD steps
+
+faceGallery::faceGallery()
+{
+    stride = 0;
+}
+
+/*
+  loads every enrolled face from the store, a user can have several
+  faces are used in place in the store's mapping with a mirrored copy, as in the
+  single user loop, and the recogniser is trained on all of them. The saved model
+  is used instead when it matches the store contents
+  @params - store(open face store); faceRecognition; modelFile(optional saved model)
+  @returns - number of users enrolled
+*/
+int faceGallery::load(const faceStore &store, recognition &faceRecognition, const string modelFile)
+{
+    names = store.names();
+    if (store.size() == 0){
+        cout << "No faces enrolled in: " << store.path() << endl;
+        return 0;
+    }
+
+    uint64_t stamp = store.stamp();
+    if (modelFile.empty() || !faceRecognition.loadModel(modelFile, stamp, (int)store.face(0).total())){
+        vector<Mat> faces;
+        vector<int> faceLabels;
+        for (int i = 0; i < store.size(); i++){
+            Mat face = store.face(i);
+            Mat mirror;
+            flip(face, mirror, 1);
+            faces.push_back(face);
+            faces.push_back(mirror);
+            faceLabels.push_back(store.label(i));
+            faceLabels.push_back(store.label(i));
+        }
+        faceRecognition.learnCollectedFaces(faces, faceLabels);
+        if (!modelFile.empty()){
+            faceRecognition.saveModel(modelFile, stamp);
+        }
+    }
+
+    buildIndex(faceRecognition.subspace);
+    cout << "Gallery: " << names.size() << " users, " << labels.size() << " faces" << endl;
+    return (int)names.size();
+}
+
+/*
+  copies the projections into one contiguous float matrix, rows padded
+  to a multiple of 4 so the search can run 4 lanes at a time
+  @params - subspace
+*/
+void faceGallery::buildIndex(const faceSubspace &subspace)
+{
+    int components = subspace.eigenvectors.cols;
+    stride = (components + 3) & ~3;
+    index = Mat::zeros((int)subspace.projections.size(), stride, CV_32F);
+    labels = subspace.labels;
+    for (size_t i = 0; i < subspace.projections.size(); i++){
+        Mat row = index.row((int)i).colRange(0, components);
+        subspace.projections[i].convertTo(row, CV_32F);
+    }
+}
+
+/*
+  projects a preprocessed face and finds the closest enrolled face
+  @params - subspace(the one the index was built from); preprocessedFace; distance(out, L2)
+  @returns - label of nearest face, -1 if gallery empty
+*/
+int faceGallery::identify(const faceSubspace &subspace, const Mat preprocessedFace, float &distance)
+{
+    distance = FLT_MAX;
+    if (index.empty() || subspace.empty()){
+        return -1;
+    }
+    Mat projection = subspaceProject(subspace.eigenvectors, subspace.mean, preprocessedFace.reshape(1, 1));
+    Mat query = Mat::zeros(1, stride, CV_32F);
+    Mat queryRow = query.colRange(0, projection.cols);
+    projection.convertTo(queryRow, CV_32F);
+    return nearest(query.ptr<float>(0), distance);
+}
+
+/*
+  searches with float coefficients from recognition::reconstructionSimilarity, no second projection
+  @params - coefficients(1 x k CV_32F); distance(out, L2)
+  @returns - label of nearest face, -1 if gallery empty or the coefficients don't match the index
+*/
+int faceGallery::identify(const Mat coefficients, float &distance)
+{
+    distance = FLT_MAX;
+    if (index.empty() || coefficients.type() != CV_32F || coefficients.cols > stride){
+        return -1;
+    }
+    AutoBuffer<float, 64> query(stride);
+    const float *coeffs = coefficients.ptr<float>(0);
+    for (int i = 0; i < stride; i++){
+        query[i] = i < coefficients.cols ? coeffs[i] : 0.0f;
+    }
+    return nearest(query, distance);
+}
+
+/*
+  exact nearest neighbour over the packed index, each row is dropped as soon as its partial
+  distance reaches the best so far. Columns are in order of decreasing eigenvalue, so most
+  rows are dropped within the first block or two; every row still costs one block
+  @params - query(stride floats); distance(out, L2)
+  @returns - label of nearest face, -1 if gallery empty
+*/
+int faceGallery::nearest(const float *query, float &distance)
+{
+    float best = FLT_MAX;
+    int label = -1;
+    for (int i = 0; i < index.rows; i++){
+        float dist = distanceBounded(index.ptr<float>(i), query, stride, best);
+        if (dist < best){
+            best = dist;
+            label = labels[i];
+        }
+    }
+    distance = (label >= 0) ? sqrt(best) : FLT_MAX;
+    return label;
+}
+
+string faceGallery::name(int label) const
+{
+    if (label < 0 || label >= (int)names.size()){
+        return "unknown";
+    }
+    return names[label];
+}
+
+int faceGallery::size() const
+{
+    return (int)names.size();
+}
+
+/*
+  distanceSquared a block at a time, giving up once the partial sum reaches bound
+  @params - a, b(vectors); length(multiple of 4); bound(distance to beat)
+  @returns - sum of squared differences, or a partial sum >= bound
+*/
+float distanceBounded(const float *a, const float *b, int length, float bound)
+{
+    float sum = 0.0f;
+    for (int i = 0; i < length; i += PARTIAL_BLOCK){
+        sum += distanceSquared(a + i, b + i, min(PARTIAL_BLOCK, length - i));
+        if (sum >= bound){
+            break;
+        }
+    }
+    return sum;
+}
+
+/*
+  squared euclidean distance, SSE2 on x86 and NEON on ARM
+  @params - a, b(vectors); length(multiple of 4)
+  @returns - sum of squared differences
+*/
+float distanceSquared(const float *a, const float *b, int length)
+{
+#if defined(__SSE2__)
+    __m128 sum = _mm_setzero_ps();
+    for (int i = 0; i < length; i += 4){
+        __m128 diff = _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+        sum = _mm_add_ps(sum, _mm_mul_ps(diff, diff));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, sum);
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#elif defined(__ARM_NEON__)
+    float32x4_t sum = vdupq_n_f32(0.0f);
+    for (int i = 0; i < length; i += 4){
+        float32x4_t diff = vsubq_f32(vld1q_f32(a + i), vld1q_f32(b + i));
+        sum = vmlaq_f32(sum, diff, diff);
+    }
+    float32x2_t pair = vadd_f32(vget_low_f32(sum), vget_high_f32(sum));
+    return vget_lane_f32(vpadd_f32(pair, pair), 0);
+#else
+    float sum = 0.0f;
+    for (int i = 0; i < length; i++){
+        float diff = a[i] - b[i];
+        sum += diff * diff;
+    }
+    return sum;
+#endif
+}
@@ -0,0 +1,49 @@
+#ifndef GALLERY_H
+#define GALLERY_H
+
+#include "recognition.h"
+#include "facestore.h"
+
+#include "opencv2/core/core.hpp"
+
+#include <string>
+#include <vector>
+
+using namespace cv;
+using namespace std;
+
+// Every enrolled user, projected once into the recogniser subspace for 1:N identification.
+class faceGallery
+{
+public:
+    faceGallery();
+
+    // Trains (or maps the saved model for) faceRecognition on every face in the store and indexes the projections.
+    int load(const faceStore &store, recognition &faceRecognition, const string modelFile = "");
+
+    // Repack the subspace projections for searching, needed whenever the subspace changes.
+    void buildIndex(const faceSubspace &subspace);
+
+    // Label of the closest enrolled face, -1 if the gallery is empty.
+    int identify(const faceSubspace &subspace, const Mat preprocessedFace, float &distance);
+    // As above from coefficients already projected by recognition::reconstructionSimilarity.
+    int identify(const Mat coefficients, float &distance);
+    int nearest(const float *query, float &distance);
+
+    string name(int label) const;
+    int size() const;
+
+    vector<string> names;       // user name per label, in order of enrolment
+
+private:
+    Mat index;                  // one zero padded CV_32F row per enrolled face
+    vector<int> labels;
+    int stride;                 // floats per index row, multiple of 4
+};
+
+// Squared L2 distance between two float vectors, length must be a multiple of 4.
+float distanceSquared(const float *a, const float *b, int length);
+// As distanceSquared, stopping once the partial sum reaches bound, so anything >= bound only means "not closer".
+float distanceBounded(const float *a, const float *b, int length, float bound);
+
+#endif // GALLERY_H
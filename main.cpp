@@ -1,6 +1,14 @@
 #include "detectobject.h"
 #include "recognition.h"
 #include "captureimages.h"
+#include "gallery.h"
+#include "pipeline.h"
+#include "batch.h"
+#include "stats.h"
+#include "decision.h"
+#include "facestore.h"
+#include "enrolmentwriter.h"
+#include "service.h"
 
 #include "opencv2/opencv.hpp"
 #include "opencv2/imgproc/imgproc.hpp"
@@ -13,8 +21,11 @@
 #include<vector>
 #include<string>
 #include<stdio.h>
+#include<time.h>
 #include <stdexcept>
 #include <QTimer>
+#include <QThread>
+#include <QReadWriteLock>
 
 using namespace cv;
 using namespace std;
@@ -30,32 +41,106 @@ template <typename T> string toString(T t)
 //define variables to be used in program
 const int CAMERA_WIDTH = 640;
 const int CAMERA_HEIGHT = 480;
+const bool NATIVE_CAPTURE = false;  //read the camera's V4L2 buffers as grey frames, VideoCapture if the camera can't
 #ifdef IMX6
 const string DATABASE_DIR = "/nvdata/config/faces/";
 #else
 const string DATABASE_DIR = "/home/standby/Projects/FacialRecognition/ProcessedFaces/";
 #endif
 const string EXT = ".png";
+const string MODEL_EXT = ".model";
+const string GALLERY_MODEL = "gallery.model";
+const string GALLERY_STORE = "gallery.store";     //every enrolled face, replaces one png per user
 string Name = "";
+string batchSource = "";        //image directory or video file, runs headless when set
+string batchOutput = "";
+vector<int> cameraDevices;      //--camera arguments, device 0 when there are none
+string serviceSocket = "";      //runs as a recognition service on this socket when set
 const float DETECTION_THRESHOLD = 0.7f;
-const int CONSECUTIVE_THRESHOLD = 8;
 const int TIMEOUT = 200;
 const int DURATION = 5000;
-const int MATCH_THRESHOLD = 15;
+const bool MOTION_GATING = true;   //no face search on frames of a static scene
+const int ACTIVE_WAIT = 20;        //ms the loop waits for a key, longer while the scene is static
+const int IDLE_WAIT = 100;
+const double FALSE_ACCEPT_RATE = 0.001;   //error rates the window decision is run to
+const double FALSE_REJECT_RATE = 0.01;
+//similarity model the window decision assumes. Unmeasured defaults, not fitted to any data: the rates
+//above only hold once these are the mean and spread of --batch similarities for enrolled users and strangers.
+//They are separate from DETECTION_THRESHOLD, which still decides which frames of an accepted window are trained on
+const double GENUINE_MEAN = 0.45;
+const double IMPOSTOR_MEAN = 0.85;
+const double SCORE_SIGMA = 0.12;
+const bool INCREMENTAL_TRAINING = true;    //fold matches into the eigenfaces, false = full retrain per match
 const int ESC_KEY = 27;
 const int ENTER_KEY = 13;
 const int SPACE_KEY = 32;
+const int SNAPSHOT_KEY = 's';
+const int DETECT_WORKERS = 2;       //face detection is the slowest stage, fewer per camera when the cores are shared
+const int ALIGN_WORKERS = 1;
+const int RECOGNISE_WORKERS = 1;
+const double DETECT_BUDGET = 150;   //ms from a frame being queued to its face search finishing, under TIMEOUT so no backlog builds, 0 = off
+const int ENROL_QUEUE = 4;          //frames waiting to be enrolled or saved, Enter is refused once it is full
+const syncPolicy WRITE_SYNC = SYNC_BATCH;
+const string SNAPSHOT_DIR = "/tmp/";
+const string STATS_SOCKET = "/tmp/FacialRecognition.sock";     //connect to read per stage latencies
+const string STATS_FILE = "/tmp/FacialRecognition.stats";      //same report, rewritten every STATS_INTERVAL ms
+const int STATS_INTERVAL = 10000;
+
+detectObject detection;
+recognition faceRecognition;
+faceGallery gallery;
+faceStore galleryStore;
+QReadWriteLock modelLock;       //every camera's pipeline reads the one recogniser under this
+
+// One camera: its capture thread and pipeline, and the state of its capture window.
+struct cameraChannel
+{
+    cameraChannel(int index, int count);
+
+    int index;
+    string title;           //stream window
+    string prefix;          //messages name the camera when there are several
+    captureImages capture;
+    recognitionPipeline pipeline;
+    sequentialDecision decision;
+    vector<Mat> windowFaces;        //matches in this window, learnt once the window accepts
+    vector<int> windowLabels;
+    Mat frame;              //newest frame, pinned in the ring for one pass of the loop
+    Mat preview;            //frame as shown, colour converted here when the capture is grey
+    int slot;
+    int shownSequence;
+    int oldCount;
+    int matches;
+    int window;
+    bool windowOpen;
+    bool sceneActive;
+    double similarity;
+};
 
 //function prototypes
-void initCamera(VideoCapture &capture);
-void detectAndRecognise(VideoCapture &capture, CascadeClassifier &faceCascade, CascadeClassifier &eyeCascade, CascadeClassifier &eyeGlassCascade);
-void storeFaces(Mat &processedFace, vector<Mat>& preProcessedFaces, vector<int>& faceLabels);
-void writeImage(Mat &image, string name);
+void initCamera(VideoCapture &capture, int device);
+void detectAndRecognise(vector<cameraChannel*> &cameras);
+void pollCamera(cameraChannel &camera, vector<Mat>& preProcessedFaces, vector<int>& faceLabels, Ptr<FaceRecognizer> &model);
+void openWindow(cameraChannel &camera);
+void printUsage();
+bool initRecogniser(vector<Mat>& preProcessedFaces, vector<int>& faceLabels, Ptr<FaceRecognizer> &model);
+void storeFaces(Mat &processedFace, vector<Mat>& preProcessedFaces, vector<int>& faceLabels, int label = 0);
+void learnWindow(const vector<Mat>& windowFaces, const vector<int>& windowLabels, int identity, recognitionPipeline &pipeline,
+                 vector<Mat>& preProcessedFaces, vector<int>& faceLabels, Ptr<FaceRecognizer> &model);
+bool openStore();
+void writeFinished(const writeJob &job, void *context);
 
 
-detectObject detection;
-recognition faceRecognition;
-captureImages captureImage;
+/*
+  prints the ways the program can be run
+*/
+void printUsage()
+{
+    cout << "Usage is ./FacialRecognition <name> to verify a single user" << endl;
+    cout << "         ./FacialRecognition [name] --batch <image dir|video> [--output results.csv] to run headless" << endl;
+    cout << "         ./FacialRecognition [name] --camera <device> [--camera <device> ...] for several cameras" << endl;
+    cout << "         ./FacialRecognition --serve <socket> to answer identify/verify requests from other programs" << endl;
+}
 
 /*
   Program entry point - initialises cascades and camera
@@ -63,46 +148,143 @@ captureImages captureImage;
 */
 int main (int argc, char* argv[])
 {
-    if (argc >= 1){
-        Name = argv[1];
-    }else{
-        cout << "No name supplied - Usage is ./FacialRecognition <name>" << endl;
-        return -1;
+    for (int i = 1; i < argc; i++){
+        string arg = argv[i];
+        bool option = arg.compare(0, 2, "--") == 0;
+        if (option && i + 1 >= argc){
+            //every option takes a value
+            cout << "Missing value for " << arg << endl;
+            printUsage();
+            return -1;
+        }
+        if (arg == "--batch"){
+            batchSource = argv[++i];
+        }else if (arg == "--output"){
+            batchOutput = argv[++i];
+        }else if (arg == "--camera"){
+            cameraDevices.push_back(atoi(argv[++i]));
+        }else if (arg == "--serve"){
+            serviceSocket = argv[++i];
+        }else if (option){
+            cout << "Unknown option " << arg << endl;
+            printUsage();
+            return -1;
+        }else{
+            Name = arg;
+        }
+    }
+    if (!serviceSocket.empty() && !Name.empty()){
+        //requests name the user they verify, the service loads every enrolled face
+        cout << "--serve identifies against all faces, ignoring " << Name << endl;
+        Name = "";
+    }
+    if (Name.empty()){
+        //no name, identify against every enrolled face
+        cout << "No name supplied - identifying against all faces in " << DATABASE_DIR << endl;
+        printUsage();
     }
 
-    CascadeClassifier faceCascade;
-    CascadeClassifier eyeCascade;
-    CascadeClassifier eyeGlassCascade;
-    VideoCapture capture;
+    //latency histograms for monitoring
+    statsExporter exporter;
+    exporter.start(STATS_SOCKET, STATS_FILE, STATS_INTERVAL);
+
+    if (!batchSource.empty()){
+        //headless, no camera or windows
+        vector<Mat> preProcessedFaces;
+        vector<int> faceLabels;
+        Ptr<FaceRecognizer> model;
+        if (!initRecogniser(preProcessedFaces, faceLabels, model)){
+            cout << "No trained faces, nothing to recognise against" << endl;
+            return -1;
+        }
+        batchProcessor batch(detection, faceRecognition, Name.empty() ? &gallery : NULL, Name);
+        batch.threshold = DETECTION_THRESHOLD;
+        int items = batch.run(batchSource, batchOutput);
+        cout << stageStats.report();
+        return items < 0 ? -1 : 0;
+    }
 
-    //initialise the three cascade classifiers to be used
-    //initCascades(faceCascade, eyeCascade, eyeGlassCascade);
-    detection.initCascades(faceCascade, eyeCascade, eyeGlassCascade);
+    if (!serviceSocket.empty()){
+        //resident, cascades and model stay loaded between requests until SIGINT/SIGTERM
+        vector<Mat> preProcessedFaces;
+        vector<int> faceLabels;
+        Ptr<FaceRecognizer> model;
+        if (!initRecogniser(preProcessedFaces, faceLabels, model)){
+            cout << "No trained faces, nothing to recognise against" << endl;
+            return -1;
+        }
+        recognitionService service(detection, faceRecognition, gallery, &modelLock);
+        service.threshold = DETECTION_THRESHOLD;
+        int detectWorkers = max(1, QThread::idealThreadCount() - ALIGN_WORKERS - RECOGNISE_WORKERS);
+        int requests = service.run(serviceSocket, detectWorkers, ALIGN_WORKERS);
+        cout << stageStats.report();
+        return requests < 0 ? -1 : 0;
+    }
 
-    //initialise the camera
-    initCamera(capture);
+    if (cameraDevices.empty()){
+        cameraDevices.push_back(0);
+    }
+    if ((int)cameraDevices.size() > MAX_CAMERAS){
+        cout << "Using the first " << MAX_CAMERAS << " cameras" << endl;
+        cameraDevices.resize(MAX_CAMERAS);
+    }
+    stageStats.setCameras((int)cameraDevices.size());
+
+    //each camera gets its own capture thread and pipeline, cascade classifiers are loaded by each pipeline worker
+    vector<cameraChannel*> cameras;
+    for (size_t i = 0; i < cameraDevices.size(); i++){
+        cameraChannel *camera = new cameraChannel((int)i, (int)cameraDevices.size());
+        //initialise the camera, frames are read on the capture thread from here on
+        if (!NATIVE_CAPTURE || !camera->capture.startCapture(cameraDevices[i], CAMERA_WIDTH, CAMERA_HEIGHT, (int)i)){
+            VideoCapture capture;
+            initCamera(capture, cameraDevices[i]);
+            camera->capture.startCapture(capture, (int)i);
+        }
+        cameras.push_back(camera);
+    }
 
     //check if user exists
     //enter program loop
-    detectAndRecognise(capture, faceCascade, eyeCascade, eyeGlassCascade);
+    detectAndRecognise(cameras);
+    for (size_t i = 0; i < cameras.size(); i++){
+        cameras[i]->capture.stopCapture();
+        delete cameras[i];
+    }
 
     return 0;
 }
 
+cameraChannel::cameraChannel(int index, int count)
+    : index(index), pipeline(detection, faceRecognition, Name.empty() ? &gallery : NULL, &modelLock),
+      decision(FALSE_ACCEPT_RATE, FALSE_REJECT_RATE, GENUINE_MEAN, IMPOSTOR_MEAN, SCORE_SIGMA)
+{
+    title = index == 0 ? "stream" : "stream " + toString(index);
+    prefix = count > 1 ? "Camera " + toString(index) + ": " : "";
+    pipeline.camera = index;
+    slot = -1;
+    shownSequence = -1;
+    oldCount = 0;
+    matches = 0;
+    window = 0;
+    windowOpen = false;
+    sceneActive = true;
+    similarity = 0;
+}
+
 /*
     Initialises and opens camera stream
-    @params VideoCapture
+    @params VideoCapture; device(camera number)
 */
-void initCamera(VideoCapture& capture)
+void initCamera(VideoCapture& capture, int device)
 {
     try{
-        capture.open(0);
+        capture.open(device);
         capture.set(CV_CAP_PROP_FRAME_WIDTH,CAMERA_WIDTH);
         capture.set(CV_CAP_PROP_FRAME_HEIGHT, CAMERA_HEIGHT);
         if(capture.isOpened()){
-            cout << "Stream opened sucessfully" << endl;
+            cout << "Stream " << device << " opened sucessfully" << endl;
         }else{
-            cout << "Error opening stream" << endl;
+            cout << "Error opening stream " << device << endl;
         }
     }
     catch(cv::Exception &e){
@@ -115,31 +297,22 @@ void initCamera(VideoCapture& capture)
     Main program loop
     Loads database image, processess it and then trains the FaceRecogniser
     Streams camera image, on button press captures frame, processess and compares
-    @params VideoCapture; FaceCascade; eyeCascade; eyeGlassCascade
+    frames come from each camera's capture thread ring and are read in place, detection,
+    preprocessing and recognition run on that camera's pipeline threads and this loop decides
+    for every camera. The pipelines share the recogniser and the gallery
 */
 
-void detectAndRecognise(VideoCapture &capture, CascadeClassifier& faceCascade, CascadeClassifier& eyeCascade, CascadeClassifier& eyeGlassCascade)
+void detectAndRecognise(vector<cameraChannel*> &cameras)
 {
     cout << "Face Recognition with open cv" << endl;
     cout << "press 'spacebar' to capture image and compare with database" << endl;
     cout << "press 'enter' to add user" << endl;
+    cout << "press 's' to save a snapshot" << endl;
     cout << "press 'esc' to exit" << endl;
 
-    vector<Mat> userFaces;
     Ptr<FaceRecognizer> model;
     vector<Mat> preProcessedFaces;
     vector<int> faceLabels;    
-    Mat processedImage;
-    Mat frame;
-    Mat userFace;
-    string databaseImage;
-    int matches = 0;
-    int oldCount = 0;
-    double similarity;
-    int consecutive =0;
-
-    int identity = -1;
-    databaseImage = DATABASE_DIR + Name + EXT;
 
     //Try to load image specified by Name
     //if fail enter loop waiting for enter keypress
@@ -163,138 +336,321 @@ void detectAndRecognise(VideoCapture &capture, CascadeClassifier& faceCascade, C
         }
     }*/
 
-    //put image through preProcessing - returns a Mat of the face ROI
-    //processedImage = detection.processImage(referenceFace, faceCascade, eyeCascade, eyeGlassCascade);
-    try{
-        processedImage = imread(databaseImage, -1);
-    }catch(cv::Exception &e){};
-    cout << "processsedsize: " << toString(processedImage.elemSize()) << endl;
-    if(!processedImage.empty()){
-        imshow("processed", processedImage);
-        //Add the processed face to the array
-        //Train the recogniser
-        storeFaces(processedImage, preProcessedFaces, faceLabels);
-        model = faceRecognition.learnCollectedFaces(preProcessedFaces, faceLabels);
-    }
-    //free up resources
-    processedImage.release();
+    initRecogniser(preProcessedFaces, faceLabels, model);
 
+    //split the cores between the cameras, each keeps at least one detect worker
+    int perCamera = QThread::idealThreadCount() / (int)cameras.size();
+    int detectWorkers = max(1, min(DETECT_WORKERS, perCamera - ALIGN_WORKERS));
+    for (size_t i = 0; i < cameras.size(); i++){
+        cameras[i]->pipeline.scheduler.budget = DETECT_BUDGET;
+        cameras[i]->pipeline.start(detectWorkers, ALIGN_WORKERS, RECOGNISE_WORKERS);
+    }
+    //enrolments and snapshots are preprocessed and written off this loop
+    enrolmentWriter writer(detection, galleryStore, ENROL_QUEUE);
+    writer.start(WRITE_SYNC, writeFinished);
 
     while(true)
     {
-        //stream camera image to gui window
-        capture >> frame;
-        imshow("stream", frame);
-
-
-        if(oldCount != captureImage.count){
-            captureImage.startTimer(TIMEOUT, DURATION,  capture, userFaces, true);
-            Mat face = userFaces.at(oldCount);
-            QTime time;
-            time.start();
-            userFace = detection.processImage(face, faceCascade, eyeCascade, eyeGlassCascade);
-            if(!userFace.empty()){  //if processing successful
-                Mat reconstructedFace = faceRecognition.reconstructFace(model, userFace);   //project to pca space
-
-                double size = reconstructedFace.elemSize();
-                cout << "size: " << toString(size) << endl;
-                //size_t size = reconstructedFace.elemSize();
-                //cout << "size: " << toString(size) << endl;
-                similarity = faceRecognition.getSimilarity(userFace, reconstructedFace); //compare with stored images
-                string output;
-                if (similarity < DETECTION_THRESHOLD){
-                    identity = model->predict(userFace);
-                    output = toString(identity);
-                    storeFaces(userFace, preProcessedFaces, faceLabels);
-                    model = faceRecognition.learnCollectedFaces(preProcessedFaces, faceLabels); //re-train face rec with more matches
-                    int t = time.elapsed();
-                    cout << "time taken: " << t << endl;
-                    cout << "matches: " << matches << endl;
-                    matches++;
-                    consecutive++;
-                }else{
-                    cout << "face not recognised" << endl;
-                    consecutive = 0;                    
+        bool anyActive = false;
+        for (size_t i = 0; i < cameras.size(); i++){
+            pollCamera(*cameras[i], preProcessedFaces, faceLabels, model);
+            anyActive = anyActive || cameras[i]->sceneActive;
+        }
+
+        char c = waitKey(anyActive ? ACTIVE_WAIT : IDLE_WAIT);
+        if(c == ENTER_KEY){      //if enter
+            //enrol from the first camera that sees movement, or the first camera
+            cameraChannel *source = NULL;
+            for (size_t i = 0; i < cameras.size(); i++){
+                if (cameras[i]->slot >= 0 && (source == NULL || (cameras[i]->sceneActive && !source->sceneActive))){
+                    source = cameras[i];
                 }
-            }else{
-                consecutive = 0;
-                cout << "No face detected" << endl;
             }
-            oldCount = captureImage.count;
-
-            if (matches >= MATCH_THRESHOLD || consecutive >= CONSECUTIVE_THRESHOLD){
-                captureImage.endTimer();
-                cout << "Identity: " << Name << " Similarity: " << similarity << " Matches: " << matches << endl;
-            }else if(captureImage.done){
-                cout << "User Not detected" << endl;
+            if (Name.empty()){
+                cout << "Supply a name on the command line to add a user" << endl;
+            }else if (source != NULL && writer.enrol(source->frame, Name) < 0){
+                cout << "Enrolment queue full, frame skipped" << endl;
             }
         }
-        if(captureImage.done){
-            matches = consecutive = 0;
-            userFace = Mat();
-            model.release();
-            userFaces.clear();
+        for (size_t i = 0; i < cameras.size(); i++){
+            cameraChannel &camera = *cameras[i];
+            if (c == SNAPSHOT_KEY && camera.slot >= 0){
+                if (camera.preview.empty()){
+                    //frame was already on screen, save it as it is shown
+                    camera.capture.previewImage(camera.slot, camera.frame, camera.preview);
+                }
+                string snapshot = SNAPSHOT_DIR + "snapshot-" + toString(time(NULL)) + "-" + toString(camera.index) + "-" +
+                                  toString(camera.shownSequence) + EXT;
+                if (writer.snapshot(camera.preview, snapshot) < 0){
+                    cout << camera.prefix << "Write queue full, snapshot skipped" << endl;
+                }
+            }
+            //done with the frame, the capture thread can reuse its slot
+            camera.frame.release();
+            camera.preview.release();
+            camera.capture.frames.release(camera.slot);
+            camera.slot = -1;
         }
 
-        char c = waitKey(20);
         if (c == ESC_KEY){       //if esc key leave program
             break;
-        }else if(c == ENTER_KEY){      //if enter
-            writeImage(frame, Name);
         }
         else if(c == SPACE_KEY){ //if spacebar capture frame and run detection program
-            captureImage.startTimer(TIMEOUT, DURATION,  capture, userFaces, false);
-            oldCount = captureImage.count;
+            for (size_t i = 0; i < cameras.size(); i++){
+                openWindow(*cameras[i]);
+            }
         }
     }
+    for (size_t i = 0; i < cameras.size(); i++){
+        cameras[i]->pipeline.stop();
+    }
+    writer.stop();
     cvDestroyAllWindows();
     return;
 }
 
+/*
+  one pass of the loop for one camera: shows the newest frame, queues frames while its capture window
+  is open and decides on the results. The newest frame is left pinned in camera.frame until the end of the pass
+  @params - camera; preProcessedFaces, faceLabels, model(shared training state, for learnWindow)
+*/
+void pollCamera(cameraChannel &camera, vector<Mat>& preProcessedFaces, vector<int>& faceLabels, Ptr<FaceRecognizer> &model)
+{
+    bool identifyAll = Name.empty();
+    captureImages &capture = camera.capture;
+    recognitionPipeline &pipeline = camera.pipeline;
+    sequentialDecision &decision = camera.decision;
+
+    //stream camera image to gui window
+    int sequence;
+    camera.slot = capture.frames.acquireLatest(camera.frame, sequence);
+    if (camera.slot >= 0 && sequence != camera.shownSequence){
+        capture.previewImage(camera.slot, camera.frame, camera.preview);
+        imshow(camera.title, camera.preview);
+        camera.shownSequence = sequence;
+    }
+
+    //nothing moving, leave the cascades idle until something enters the scene
+    bool active = !MOTION_GATING || capture.sceneActive();
+    if (active != camera.sceneActive){
+        cout << camera.prefix << (active ? "Motion, detection resumed" : "Scene static, detection idle") << endl;
+        camera.sceneActive = active;
+    }
+
+    //queue a frame for every capture window tick
+    if(camera.windowOpen && camera.oldCount != capture.count){
+        if (camera.sceneActive && !pipeline.submit(capture.frames, camera.window)){
+            cout << camera.prefix << "pipeline busy, frame skipped" << endl;
+        }
+        camera.oldCount = capture.count;
+    }
+
+    //decide, results come back in capture order
+    pipelineItem result;
+    while (camera.windowOpen && pipeline.nextResult(result)){
+        if (result.window != camera.window){
+            continue;   //left over from an earlier window
+        }
+        Mat userFace = result.face;
+        if(!userFace.empty()){  //if processing successful
+            camera.similarity = result.similarity;
+            if (camera.similarity < DETECTION_THRESHOLD){
+                //keep it for training, in case the window accepts this identity
+                storeFaces(userFace, camera.windowFaces, camera.windowLabels, result.identity);
+                int t = result.timer.elapsed();
+                cout << camera.prefix << "time taken: " << t << endl;
+                cout << camera.prefix << "matches: " << camera.matches << endl;
+                camera.matches++;
+            }else{
+                cout << camera.prefix << "face not recognised" << endl;
+            }
+            decision.add(camera.similarity, result.identity);
+        }else{
+            cout << camera.prefix << "No face detected" << endl;
+        }
+
+        if (decision.state() == DECISION_ACCEPT){
+            capture.endTimer();
+            int identity = decision.identity();
+            cout << camera.prefix << "Identity: " << (identifyAll ? gallery.name(identity) : Name) << " Similarity: "
+                 << camera.similarity << " Matches: " << camera.matches << " Frames: " << decision.frames() << endl;
+            camera.windowOpen = false;
+            learnWindow(camera.windowFaces, camera.windowLabels, identity, pipeline, preProcessedFaces, faceLabels, model);
+        }else if (decision.state() == DECISION_REJECT){
+            capture.endTimer();
+            cout << camera.prefix << "User Not recognised after " << decision.frames() << " frames" << endl;
+            camera.windowOpen = false;
+        }
+    }
+    //window timed out and every frame taken in it has been decided
+    if(camera.windowOpen && capture.done && pipeline.inFlight() == 0){
+        cout << camera.prefix << "User Not detected" << endl;
+        camera.windowOpen = false;
+    }
+    if(!camera.windowOpen && capture.done){
+        camera.matches = 0;
+        decision.reset();
+        camera.windowFaces.clear();
+        camera.windowLabels.clear();
+        model.release();
+    }
+}
+
+/*
+  starts a capture window on the camera, its frames are queued every TIMEOUT ms for DURATION ms
+  @params - camera
+*/
+void openWindow(cameraChannel &camera)
+{
+    camera.capture.startTimer(TIMEOUT, DURATION);
+    camera.oldCount = camera.capture.count;
+    camera.matches = 0;
+    camera.decision.reset();
+    camera.windowFaces.clear();
+    camera.windowLabels.clear();
+    camera.window++;
+    camera.windowOpen = true;
+}
+
+
+/*
+  loads or trains the recogniser, the whole gallery without a name, otherwise the named user
+  @params - preProcessedFaces, faceLabels(out, raw faces kept for full retraining); model(out, when trained here)
+  @returns - false if there is nothing to recognise against
+*/
+bool initRecogniser(vector<Mat>& preProcessedFaces, vector<int>& faceLabels, Ptr<FaceRecognizer> &model)
+{
+    //use the saved model if it was built from the faces now in the store,
+    //otherwise train from scratch on the mapped faces
+    bool identifyAll = Name.empty();
+    if (!openStore()){
+        return false;
+    }
+    string modelFile = DATABASE_DIR + Name + MODEL_EXT;
+    vector<int> userFaces = galleryStore.find(Name);
+    uint64_t stamp = galleryStore.stamp(Name);
+    bool modelLoaded = false;
+    if (identifyAll){
+        //1:N, gallery trains or maps the model for every enrolled user
+        modelLoaded = gallery.load(galleryStore, faceRecognition, DATABASE_DIR + GALLERY_MODEL) > 0;
+    }else if (!userFaces.empty() && faceRecognition.loadModel(modelFile, stamp, (int)galleryStore.face(userFaces[0]).total())){
+        modelLoaded = true;
+        cout << "Loaded model: " << modelFile << endl;
+    }
+
+    //full retraining needs the raw faces as well
+    if (!identifyAll && (!modelLoaded || !INCREMENTAL_TRAINING) && !userFaces.empty()){
+        for (size_t i = 0; i < userFaces.size(); i++){
+            //Add the processed face to the array, straight from the store's mapping
+            Mat processedImage = galleryStore.face(userFaces[i]);
+            storeFaces(processedImage, preProcessedFaces, faceLabels);
+        }
+        if (batchSource.empty()){
+            imshow("processed", preProcessedFaces.back());
+        }
+        if (!modelLoaded){
+            //Train the recogniser and keep the result for the next start
+            model = faceRecognition.learnCollectedFaces(preProcessedFaces, faceLabels);
+            faceRecognition.saveModel(modelFile, stamp);
+        }
+    }
+    return modelLoaded || !faceRecognition.subspace.empty();
+}
+
+/*
+  opens the face store, when it is new the pngs already enrolled in DATABASE_DIR are imported
+  @returns - false if the store can't be used
+*/
+bool openStore()
+{
+    if (galleryStore.isOpen()){
+        return true;
+    }
+    if (!galleryStore.open(DATABASE_DIR + GALLERY_STORE, FACE_WIDTH, FACE_WIDTH)){
+        return false;
+    }
+    if (galleryStore.size() == 0){
+        galleryStore.import(DATABASE_DIR);
+    }
+    return true;
+}
+
+/*
+  trains on the faces an accepted window matched to the accepted identity, either folding
+  them into the eigenfaces or retraining from scratch
+  @params - windowFaces, windowLabels(matches from the window, with mirrors); identity(accepted label);
+            pipeline(for its model lock); preProcessedFaces, faceLabels(all faces learnt); model(out, on full retrain)
+*/
+void learnWindow(const vector<Mat>& windowFaces, const vector<int>& windowLabels, int identity, recognitionPipeline &pipeline,
+                 vector<Mat>& preProcessedFaces, vector<int>& faceLabels, Ptr<FaceRecognizer> &model)
+{
+    bool identifyAll = Name.empty();
+    vector<Mat> newFaces;
+    vector<int> newLabels;
+    for (size_t i = 0; i < windowFaces.size(); i++){
+        if (windowLabels[i] == identity){
+            newFaces.push_back(windowFaces[i]);
+            newLabels.push_back(windowLabels[i]);
+        }
+    }
+    if (newFaces.empty()){
+        return;
+    }
+
+    QWriteLocker lock(&pipeline.modelLock);
+    if (INCREMENTAL_TRAINING){
+        //update mean & eigenfaces with just the new matches
+        faceRecognition.updateCollectedFaces(newFaces, newLabels);
+        preProcessedFaces.insert(preProcessedFaces.end(), newFaces.begin(), newFaces.end());
+        faceLabels.insert(faceLabels.end(), newLabels.begin(), newLabels.end());
+        if (identifyAll){
+            //basis moved, repack the gallery projections
+            gallery.buildIndex(faceRecognition.subspace);
+        }
+    }else if (identifyAll){
+        //gallery faces aren't kept in memory, so no full retrain in 1:N mode
+    }else{
+        preProcessedFaces.insert(preProcessedFaces.end(), newFaces.begin(), newFaces.end());
+        faceLabels.insert(faceLabels.end(), newLabels.begin(), newLabels.end());
+        model = faceRecognition.learnCollectedFaces(preProcessedFaces, faceLabels); //re-train face rec with more matches
+    }
+}
 
 /*
   Adds processed face image to array of faces
-  @params processedFace(single image); preProcessedFaces(array); faceLabels(array)
+  @params processedFace(single image); preProcessedFaces(array); faceLabels(array); label(user, 0 when verifying one user)
 */
 
-void storeFaces(Mat &processedFace, vector<Mat>& preProcessedFaces, vector<int>& faceLabels)
+void storeFaces(Mat &processedFace, vector<Mat>& preProcessedFaces, vector<int>& faceLabels, int label)
 {
     Mat mirror;
     flip(processedFace, mirror, 1);
     //flip and store image so that FaceRecognizer has more training data
     preProcessedFaces.push_back(processedFace);
     preProcessedFaces.push_back(mirror);
-    //only one user so label is always the same
-    faceLabels.push_back(0);
-    faceLabels.push_back(0);
+    faceLabels.push_back(label);
+    faceLabels.push_back(label);
     //cout << "processed faces: " << preProcessedFaces.size() << endl;
     return;
 }
 
 /*
-    writes image to specified location in png format
-    @params - image, name(string);
+    reports a finished enrolment or snapshot, runs on the writer thread
+    @params - job; context(unused)
 */
 
-void writeImage(Mat &image, string name)
+void writeFinished(const writeJob &job, void *context)
 {
-    //set parameters fopr appropriate file formate
-
-    vector<int> compression_params;
-   compression_params.push_back(CV_IMWRITE_PNG_COMPRESSION);
-   compression_params.push_back(9);
-   string filename = DATABASE_DIR + name+".png";
-    //write image
-   try {
-       imwrite(filename, image, compression_params);
-   }
-   catch (cv::Exception &ex) {
-       fprintf(stderr, "Exception converting image to PNG format: %s\n", ex.what());
-       return;
-   }
-
-   fprintf(stdout, "Saved PNG file with alpha data.\n");
-   return;
+    (void)context;
+    if (job.kind == ENROL_WRITE){
+        if (job.written){
+            fprintf(stdout, "Enrolled %s in %d ms\n", job.name.c_str(), (int)job.timer.elapsed());
+        }else{
+            fprintf(stderr, "Could not enrol %s\n", job.name.c_str());
+        }
+    }else if (job.written){
+        fprintf(stdout, "Saved snapshot %s\n", job.name.c_str());
+    }
+    return;
 }
 
-
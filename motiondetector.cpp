@@ -0,0 +1,97 @@
+#include "motiondetector.h"
+
+#include <stdlib.h>
+
+using namespace cv;
+using namespace std;
+
+const int GRID_WIDTH = 80;          // sample grid, every 8th pixel of a 640x480 frame
+const int GRID_HEIGHT = 60;
+const int BLOCK_SIZE = 10;          // grid cells per block side, 8 x 6 blocks
+const int BLOCK_THRESHOLD = 12;     // mean grey difference from the background that counts as change
+const int MOTION_MIN_BLOCKS = 1;    // changed blocks needed to report motion
+const int BACKGROUND_RATE = 5;      // static blocks move 1/32 of the way to the frame per update
+const int FOREGROUND_RATE = 7;      // changed blocks 1/128, about 8s at 30fps to absorb someone standing still
+
+motionDetector::motionDetector()
+    : samples(GRID_WIDTH * GRID_HEIGHT), background(GRID_WIDTH * GRID_HEIGHT)
+{
+    changed = 0;
+    primed = false;
+}
+
+void motionDetector::reset()
+{
+    changed = 0;
+    primed = false;
+}
+
+/*
+  point samples the frame onto the grid, each cell is the 2x2 average at its centre
+  green stands in for luma on colour frames
+  @params - frame(CV_8U, 1 or more channels)
+*/
+void motionDetector::sample(const Mat &frame)
+{
+    int channels = frame.channels();
+    int channel = channels >= 3 ? 1 : 0;
+    for (int gy = 0; gy < GRID_HEIGHT; gy++){
+        int y = (gy * 2 + 1) * frame.rows / (GRID_HEIGHT * 2);
+        const uchar *row = frame.ptr<uchar>(y);
+        const uchar *next = frame.ptr<uchar>(min(y + 1, frame.rows - 1));
+        uchar *out = &samples[gy * GRID_WIDTH];
+        for (int gx = 0; gx < GRID_WIDTH; gx++){
+            int column = (gx * 2 + 1) * frame.cols / (GRID_WIDTH * 2);
+            int x = column * channels + channel;
+            int right = min(column + 1, frame.cols - 1) * channels + channel;
+            out[gx] = (uchar)((row[x] + row[right] + next[x] + next[right] + 2) >> 2);
+        }
+    }
+}
+
+/*
+  block wise difference against the running background, then moves the background towards
+  the frame, slowly where the block changed
+  @params - frame(camera image)
+  @returns - true if at least MOTION_MIN_BLOCKS blocks changed
+*/
+bool motionDetector::update(const Mat &frame)
+{
+    if (frame.empty() || frame.depth() != CV_8U){
+        return false;
+    }
+    sample(frame);
+    if (!primed){
+        for (size_t i = 0; i < samples.size(); i++){
+            background[i] = samples[i] << 8;
+        }
+        primed = true;
+        changed = 0;
+        return false;
+    }
+
+    changed = 0;
+    for (int by = 0; by < GRID_HEIGHT; by += BLOCK_SIZE){
+        for (int bx = 0; bx < GRID_WIDTH; bx += BLOCK_SIZE){
+            int difference = 0;
+            for (int y = by; y < by + BLOCK_SIZE; y++){
+                for (int x = bx; x < bx + BLOCK_SIZE; x++){
+                    int i = y * GRID_WIDTH + x;
+                    difference += abs(samples[i] - (background[i] >> 8));
+                }
+            }
+            bool moving = difference > BLOCK_THRESHOLD * BLOCK_SIZE * BLOCK_SIZE;
+            if (moving){
+                changed++;
+            }
+            int rate = moving ? FOREGROUND_RATE : BACKGROUND_RATE;
+            for (int y = by; y < by + BLOCK_SIZE; y++){
+                for (int x = bx; x < bx + BLOCK_SIZE; x++){
+                    int i = y * GRID_WIDTH + x;
+                    background[i] += ((samples[i] << 8) - background[i]) >> rate;
+                }
+            }
+        }
+    }
+    return changed >= MOTION_MIN_BLOCKS;
+}
@@ -0,0 +1,38 @@
+#ifndef MOTIONDETECTOR_H
+#define MOTIONDETECTOR_H
+
+#include "opencv2/core/core.hpp"
+
+#include <vector>
+
+using namespace cv;
+
+/*
+  Cheap scene change test for gating the face search. The frame is point sampled down to
+  a small grey grid and compared block by block against a running background, so a static
+  scene costs a few thousand pixel reads per frame and no OpenCV calls.
+  Changed blocks are absorbed into the background slowly, someone standing still in front
+  of the camera stays foreground for several seconds.
+*/
+class motionDetector
+{
+public:
+    motionDetector();
+
+    // compares the frame (grey or BGR) with the background and updates it, true if enough of the scene changed
+    bool update(const Mat &frame);
+    // forgets the background, the next frame becomes it
+    void reset();
+    // blocks that differed from the background in the last update
+    int changedBlocks() const { return changed; }
+
+private:
+    void sample(const Mat &frame);
+
+    std::vector<uchar> samples;     // current frame, one grey value per grid cell
+    std::vector<int> background;    // per cell, 8 fractional bits
+    int changed;
+    bool primed;
+};
+
+#endif // MOTIONDETECTOR_H
@@ -0,0 +1,320 @@
+#include "pipeline.h"
+#include "stats.h"
+
+#include "opencv2/opencv.hpp"
+#include "opencv2/objdetect/objdetect.hpp"
+
+#include <QThread>
+#include <QReadWriteLock>
+#include <QElapsedTimer>
+
+#include <iostream>
+
+using namespace cv;
+using namespace std;
+
+const int DETECT_QUEUE = 2;         //frames waiting for detection, each keeps a ring slot pinned
+const int STAGE_QUEUE = 4;
+const int RESULT_QUEUE = 32;
+const int RECOGNISE_BATCH = 8;      //most faces the recognise stage scores in one call
+
+// Runs one stage of the pipeline until its input queue is closed.
+class pipelineWorker : public QThread
+{
+public:
+    pipelineWorker(recognitionPipeline *pipeline, int stage) : pipeline(pipeline), stage(stage) {}
+
+protected:
+    void run()
+    {
+        pipeline->runStage(stage);
+    }
+
+private:
+    recognitionPipeline *pipeline;
+    int stage;
+};
+
+recognitionPipeline::recognitionPipeline(detectObject &detection, recognition &faceRecognition, faceGallery *gallery,
+                                         QReadWriteLock *sharedModelLock)
+    : modelLock(sharedModelLock != NULL ? *sharedModelLock : ownModelLock),
+      detection(detection), faceRecognition(faceRecognition), gallery(gallery),
+      detectQueue(DETECT_QUEUE), alignQueue(STAGE_QUEUE), recogniseQueue(STAGE_QUEUE), resultQueue(RESULT_QUEUE)
+{
+    tickets = 0;
+    nextTicket = 0;
+    camera = -1;
+    batchWait = 0;
+}
+
+recognitionPipeline::~recognitionPipeline()
+{
+    stop();
+}
+
+/*
+  starts the worker threads for each stage
+  @params - detectWorkers; alignWorkers; recogniseWorkers (threads per stage)
+*/
+void recognitionPipeline::start(int detectWorkers, int alignWorkers, int recogniseWorkers)
+{
+    stop();
+    detectQueue.reopen();
+    alignQueue.reopen();
+    recogniseQueue.reopen();
+    resultQueue.reopen();
+    tickets = 0;
+    nextTicket = 0;
+    pending.clear();
+    tracker.reset();
+    scheduler.reset();
+
+    for (int i = 0; i < detectWorkers; i++){
+        workers.push_back(new pipelineWorker(this, DETECT_STAGE));
+    }
+    for (int i = 0; i < alignWorkers; i++){
+        workers.push_back(new pipelineWorker(this, ALIGN_STAGE));
+    }
+    for (int i = 0; i < recogniseWorkers; i++){
+        workers.push_back(new pipelineWorker(this, RECOGNISE_STAGE));
+    }
+    for (size_t i = 0; i < workers.size(); i++){
+        workers[i]->start();
+    }
+}
+
+/*
+  closes every queue and waits for the workers, frames still in flight are dropped
+*/
+void recognitionPipeline::stop()
+{
+    detectQueue.close();
+    alignQueue.close();
+    recogniseQueue.close();
+    resultQueue.close();
+    for (size_t i = 0; i < workers.size(); i++){
+        workers[i]->wait();
+        delete workers[i];
+    }
+    workers.clear();
+}
+
+/*
+  queues the newest captured frame, the frame is read in place from the ring
+  and only released once the detect stage has its grayscale copy
+  @params - frames(capture ring); window(capture window the frame belongs to)
+  @returns - false if nothing captured yet or the detect queue is full
+*/
+bool recognitionPipeline::submit(frameRing &frames, int window)
+{
+    pipelineItem item;
+    int sequence;
+    item.slot = frames.acquireLatest(item.frame, sequence);
+    if (item.slot < 0){
+        return false;
+    }
+    item.ring = &frames;
+    item.window = window;
+    item.ticket = tickets;
+    item.timer.start();
+    if (!detectQueue.tryPush(item)){
+        item.frame.release();
+        frames.release(item.slot);
+        return false;
+    }
+    tickets++;
+    return true;
+}
+
+/*
+  decide stage input, results finish out of order so later ones are held back
+  until the next ticket arrives
+  @params - item(out); timeout(ms to wait, 0 = don't block)
+  @returns - true if a result was returned
+*/
+bool recognitionPipeline::nextResult(pipelineItem &item, int timeout)
+{
+    while (pending.find(nextTicket) == pending.end()){
+        pipelineItem result;
+        if (!resultQueue.pop(result, timeout)){
+            return false;
+        }
+        pending[result.ticket] = result;
+    }
+    item = pending[nextTicket];
+    pending.erase(nextTicket);
+    nextTicket++;
+    return true;
+}
+
+/*
+  queues a frame owned by the caller, used when reading files rather than the camera
+  @params - frame; window
+  @returns - false if the detect queue is full, the caller should take results and retry
+*/
+bool recognitionPipeline::submit(const Mat &frame, int window)
+{
+    pipelineItem item;
+    item.frame = frame;
+    item.window = window;
+    item.ticket = tickets;
+    item.timer.start();
+    if (!detectQueue.tryPush(item)){
+        return false;
+    }
+    tickets++;
+    return true;
+}
+
+/*
+  queues a face that was preprocessed elsewhere, it skips detection and alignment
+  @params - face(FACE_WIDTH square, 8-bit grey); window
+  @returns - false if the recognise queue is full, the caller should take results and retry
+*/
+bool recognitionPipeline::submitFace(const Mat &face, int window)
+{
+    pipelineItem item;
+    item.face = face;
+    item.window = window;
+    item.ticket = tickets;
+    item.timer.start();
+    if (!recogniseQueue.tryPush(item)){
+        return false;
+    }
+    tickets++;
+    return true;
+}
+
+int recognitionPipeline::inFlight()
+{
+    return tickets - nextTicket;
+}
+
+void recognitionPipeline::finish(pipelineItem &item)
+{
+    if (camera >= 0){
+        stageStats.recordFrame(camera, item.timer.nsecsElapsed());
+    }
+    item.frame.release();
+    item.grey.release();
+    item.pyramid.release();
+    resultQueue.push(item);
+}
+
+/*
+  worker body, pops from the stage's queue until it is closed
+  cascades aren't thread safe so each worker loads its own, and
+  each worker preprocesses into its own workspace
+  @params - stage
+*/
+void recognitionPipeline::runStage(int stage)
+{
+    preprocessWorkspace workspace;
+    CascadeClassifier faceCascade;
+    CascadeClassifier eyeCascade;
+    CascadeClassifier eyeGlassCascade;
+    if (stage != RECOGNISE_STAGE){
+        detection.initCascades(faceCascade, eyeCascade, eyeGlassCascade);
+    }
+
+    pipelineItem item;
+    QElapsedTimer stageTimer;
+    QElapsedTimer batchTimer;
+    vector<pipelineItem> batch;     //recognise stage, reused for every batch
+    vector<Mat> faces;
+    vector<double> similarities;
+    vector<int> labels;
+    vector<Mat> coefficients;
+    switch (stage){
+    case DETECT_STAGE:
+        while (detectQueue.pop(item)){
+            stageTimer.start();
+            Mat &grey = workspace.greyBuffer();
+            framePyramid &pyramid = workspace.pyramidBuffer();
+            item.faceRect = detection.detectFace(item.frame, grey, faceCascade, workspace, &tracker, &pyramid, &scheduler);
+            item.grey = grey;
+            //the eye searches reuse the levels the face search built
+            item.pyramid = pyramid;
+            //grayscale copy made, hand the slot back to the capture thread
+            item.frame.release();
+            if (item.ring != NULL){
+                item.ring->release(item.slot);
+                item.slot = -1;
+            }
+            qint64 nsecs = stageTimer.nsecsElapsed();
+            item.stageMs[DETECT_STAGE] = nsecs / 1000000.0;
+            stageStats.record(STAT_DETECT_STAGE, nsecs);
+            //queue wait included, a backlog means the unit isn't keeping up
+            scheduler.record(item.timer.nsecsElapsed() / 1000000.0);
+            if (item.faceRect.width > 0){
+                alignQueue.push(item);
+            }else{
+                finish(item);
+            }
+        }
+        break;
+    case ALIGN_STAGE:
+        while (alignQueue.pop(item)){
+            stageTimer.start();
+            Mat faceImage = item.grey(item.faceRect);
+            Point leftEye, rightEye;
+            item.face = detection.detectEyes(faceImage, eyeCascade, eyeGlassCascade, leftEye, rightEye, workspace,
+                                             &item.pyramid);
+            item.grey.release();
+            item.pyramid.release();
+            qint64 nsecs = stageTimer.nsecsElapsed();
+            item.stageMs[ALIGN_STAGE] = nsecs / 1000000.0;
+            stageStats.record(STAT_ALIGN_STAGE, nsecs);
+            if (!item.face.empty()){
+                recogniseQueue.push(item);
+            }else{
+                finish(item);
+            }
+        }
+        break;
+    case RECOGNISE_STAGE:
+        while (recogniseQueue.pop(item)){
+            //score whatever queued up behind this face in the same batch, waiting up to batchWait for more
+            batchTimer.start();
+            batch.assign(1, item);
+            while ((int)batch.size() < RECOGNISE_BATCH){
+                int wait = batchWait - (int)batchTimer.elapsed();
+                if (!recogniseQueue.pop(item, wait > 0 ? wait : 0)){
+                    break;
+                }
+                batch.push_back(item);
+            }
+            stageTimer.start();
+            faces.clear();
+            for (size_t i = 0; i < batch.size(); i++){
+                faces.push_back(batch[i].face);
+            }
+            {
+                QReadLocker lock(&modelLock);
+                //project to pca space, the same coefficients feed the gallery search
+                faceRecognition.recogniseBatch(faces, similarities, labels, &coefficients);
+                for (size_t i = 0; i < batch.size(); i++){
+                    batch[i].similarity = similarities[i];
+                    if (gallery == NULL){
+                        batch[i].identity = labels[i];
+                        continue;
+                    }
+                    float distance;
+                    if (coefficients[i].empty()){
+                        batch[i].identity = gallery->identify(faceRecognition.subspace, batch[i].face, distance);
+                    }else{
+                        batch[i].identity = gallery->identify(coefficients[i], distance);
+                    }
+                }
+            }
+            //each face is charged its share of the batch
+            qint64 nsecs = stageTimer.nsecsElapsed() / (qint64)batch.size();
+            for (size_t i = 0; i < batch.size(); i++){
+                batch[i].stageMs[RECOGNISE_STAGE] = nsecs / 1000000.0;
+                stageStats.record(STAT_RECOGNISE_STAGE, nsecs);
+                finish(batch[i]);
+            }
+        }
+        break;
+    }
+}
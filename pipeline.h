@@ -0,0 +1,110 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <QReadWriteLock>
+#include <QElapsedTimer>
+
+#include "opencv2/core/core.hpp"
+
+#include "boundedqueue.h"
+#include "detectobject.h"
+#include "recognition.h"
+#include "gallery.h"
+#include "framering.h"
+
+#include <cfloat>
+#include <map>
+#include <vector>
+
+using namespace cv;
+using namespace std;
+
+enum pipelineStage { DETECT_STAGE, ALIGN_STAGE, RECOGNISE_STAGE, STAGE_COUNT };
+
+// One captured frame on its way through the pipeline.
+struct pipelineItem
+{
+    int ticket;             // submission order, results are handed back in this order
+    int window;             // capture window the frame was taken in
+    frameRing *ring;        // source frame stays pinned in the ring until the detect stage is done with it, NULL if not from a ring
+    int slot;
+    Mat frame;
+    Mat grey;
+    framePyramid pyramid;   // levels of grey built so far, handed from the face search to the eye searches
+    Rect faceRect;
+    Mat face;               // preprocessed face, empty if no face or eyes were found
+    double similarity;
+    int identity;
+    QElapsedTimer timer;    // started when the frame was submitted
+    double stageMs[STAGE_COUNT];    // time spent in each stage, queue waits excluded
+
+    pipelineItem() : ticket(-1), window(-1), ring(NULL), slot(-1), similarity(DBL_MAX), identity(-1)
+    {
+        for (int i = 0; i < STAGE_COUNT; i++){
+            stageMs[i] = 0;
+        }
+    }
+};
+
+class pipelineWorker;
+
+/*
+  detect -> align/preprocess -> recognise stages, each with its own worker threads and
+  a bounded queue in front of it, so frames from one capture window overlap. The decide
+  stage is the caller pulling results with nextResult, which returns them in capture order.
+*/
+class recognitionPipeline
+{
+public:
+    // pipelines sharing one recogniser must share its lock as well
+    recognitionPipeline(detectObject &detection, recognition &faceRecognition, faceGallery *gallery = NULL,
+                        QReadWriteLock *sharedModelLock = NULL);
+    ~recognitionPipeline();
+
+    void start(int detectWorkers, int alignWorkers, int recogniseWorkers);
+    void stop();
+
+    // pins the newest frame in the ring and queues it, false if the pipeline is full and the frame is skipped
+    bool submit(frameRing &frames, int window);
+    // queues a frame that isn't in a ring (file or video input), false if the detect queue is full
+    bool submit(const Mat &frame, int window);
+    // queues an already preprocessed face straight to the recognise stage, false if its queue is full
+    bool submitFace(const Mat &face, int window);
+    // next result in submission order, waits up to timeout ms for it
+    bool nextResult(pipelineItem &item, int timeout = 0);
+    // frames submitted but not yet returned by nextResult
+    int inFlight();
+
+    // the recognise stage reads the model under this lock, take it for writing before changing the model or gallery
+    QReadWriteLock &modelLock;
+    // face position shared by the detect workers, so frames after a detection only search around it
+    faceTracker tracker;
+    // face search settings, coarsened while frames take longer than scheduler.budget ms to get through detection
+    detectionScheduler scheduler;
+    // camera the frame latencies are reported under, -1 for none
+    int camera;
+    // ms the recognise stage waits for more faces to fill a batch, 0 = score whatever is already queued
+    int batchWait;
+
+private:
+    friend class pipelineWorker;
+    QReadWriteLock ownModelLock;
+    void runStage(int stage);
+    void finish(pipelineItem &item);
+
+    detectObject &detection;
+    recognition &faceRecognition;
+    faceGallery *gallery;
+
+    boundedQueue<pipelineItem> detectQueue;
+    boundedQueue<pipelineItem> alignQueue;
+    boundedQueue<pipelineItem> recogniseQueue;
+    boundedQueue<pipelineItem> resultQueue;
+    vector<pipelineWorker*> workers;
+
+    int tickets;                        // submit thread only
+    int nextTicket;                     // decide thread only
+    map<int, pipelineItem> pending;     // results waiting for an earlier ticket
+};
+
+#endif // PIPELINE_H
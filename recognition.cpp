@@ -1,4 +1,6 @@
 #include "recognition.h"
+#include "stats.h"
+#include "simdkernels.h"
 
 #include "opencv2/opencv.hpp"
 #include "opencv2/contrib/contrib.hpp"
@@ -6,15 +8,65 @@
 #include "opencv/cv.h"
 #include "opencv/cxcore.h"
 
+#include <cfloat>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 using namespace cv;
 using namespace std;
 
+const int MAX_COMPONENTS = 50;          // eigenfaces kept by training and incremental updates
+const double MIN_EIGENVALUE = 1e-6;     // directions with less variance than this are dropped
+const int CENTRED_STACK = 6400;         // floats of centred face kept on the stack, 80x80 faces
+const double NO_SIMILARITY = 100000000.0;   // faces that couldn't be compared, far above any match threshold
+
+//binary model file layout: header, padded to MODEL_DATA_OFFSET, then
+//mean (d), eigenvalues (k), eigenvectors (d x k), projections (n x k) as doubles and labels (n) as int32
+const char MODEL_MAGIC[4] = {'F', 'R', 'M', 'D'};
+const uint32_t MODEL_VERSION = 1;
+const size_t MODEL_DATA_OFFSET = 64;
+
+struct modelHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t stamp;         // galleryStamp of the images the model was trained from
+    int32_t dims;           // pixels per face
+    int32_t components;     // eigenfaces
+    int32_t faces;          // stored projections
+    int32_t samples;        // faces folded into the mean
+};
+
+/*
+  stacks faces into one matrix, one flattened face per row
+  @params - faces(array); rtype(output depth)
+  @returns - n x d matrix
+*/
+static Mat toRowMatrix(const vector<Mat> &faces, int rtype)
+{
+    int d = (int)faces[0].total();
+    Mat data((int)faces.size(), d, rtype);
+    for (size_t i = 0; i < faces.size(); i++){
+        Mat row = data.row((int)i);
+        faces[i].clone().reshape(1, 1).convertTo(row, rtype);
+    }
+    return data;
+}
+
 recognition::recognition()
 {
+    maxComponents = MAX_COMPONENTS;
+    mappedModel = NULL;
+    mappedSize = 0;
 }
 
 recognition::~recognition()
 {
+    unmapModel();
 }
 
 /*
@@ -25,6 +77,7 @@ recognition::~recognition()
 
 Ptr<FaceRecognizer> recognition::learnCollectedFaces(const vector<Mat> preprocessedFaces, const vector<int> faceLabels, const string facerecAlgorithm)
 {
+    scopedLatency timing(STAT_LEARN);
     Ptr<FaceRecognizer> model;
 
     //cout << "Learning faces using: " << facerecAlgorithm << " algorith" << endl;
@@ -42,12 +95,188 @@ Ptr<FaceRecognizer> recognition::learnCollectedFaces(const vector<Mat> preproces
         exit(1);
     }
 
+    //cap the basis, otherwise a gallery keeps ~2N eigenfaces and every lookup grows with N twice over
+    if (maxComponents > 0 && facerecAlgorithm != "FaceRecognizer.LBPH"){
+        model->set("ncomponents", maxComponents);
+    }
+
     //init done, now train from collected faces
     model->train(preprocessedFaces, faceLabels);
+    syncSubspace(model, (int)preprocessedFaces.size());
 
     return model;
 }
 
+/*
+  copies the trained eigenfaces out of the FaceRecogniser so they can be updated incrementally
+  null directions (eigenvalue ~0) are dropped so the basis stays orthonormal
+  @params - model(trained FaceRecogniser); samples(number of training faces)
+*/
+void recognition::syncSubspace(const Ptr<FaceRecognizer> model, int samples)
+{
+    Mat eigenvectors = model->get<Mat>("eigenvectors");
+    Mat eigenvalues = model->get<Mat>("eigenvalues").reshape(1, 1);
+    Mat labels = model->get<Mat>("labels");
+
+    int k = 0;
+    while (k < eigenvalues.cols && eigenvalues.at<double>(0, k) > MIN_EIGENVALUE
+           && (maxComponents <= 0 || k < maxComponents)){
+        k++;
+    }
+
+    subspace.mean = model->get<Mat>("mean").reshape(1, 1).clone();
+    subspace.eigenvectors = eigenvectors.colRange(0, k).clone();
+    subspace.eigenvalues = eigenvalues.colRange(0, k).clone();
+    subspace.projections.clear();
+    subspace.labels.clear();
+    vector<Mat> projections = model->get<vector<Mat> >("projections");
+    for (size_t i = 0; i < projections.size(); i++){
+        subspace.projections.push_back(projections[i].colRange(0, k).clone());
+        subspace.labels.push_back(labels.at<int>((int)i));
+    }
+    subspace.samples = samples;
+    cacheProjection();
+}
+
+/*
+  float copies of the basis and mean for reconstructionSimilarity, rebuilt whenever the subspace changes
+  so the per frame path never converts or copies them
+*/
+void recognition::cacheProjection()
+{
+    if (subspace.empty() || subspace.eigenvectors.empty()){
+        projectionBasis.release();
+        projectionMean.release();
+        projectionFaces.release();
+        projectionNorms.release();
+        return;
+    }
+    Mat basis = subspace.eigenvectors.t();
+    basis.convertTo(projectionBasis, CV_32F);
+    subspace.mean.convertTo(projectionMean, CV_32F);
+
+    int n = (int)subspace.projections.size();
+    int k = projectionBasis.rows;
+    projectionFaces.create(n, k, CV_32F);
+    projectionNorms.create(1, n, CV_32F);
+    for (int i = 0; i < n; i++){
+        Mat row = projectionFaces.row(i);
+        subspace.projections[i].convertTo(row, CV_32F);
+        projectionNorms.at<float>(0, i) = (float)row.dot(row);
+    }
+}
+
+/*
+  folds new faces into the existing mean and eigenbasis without a full retrain
+  the new data is split into the part the current basis already spans and a residual,
+  both are expressed in the combined basis and a small (k+p)x(k+p) eigenproblem rotates
+  it into the new principal directions. Cost depends on k and the number of new faces,
+  not on how many faces have been learnt so far
+  @params - newFaces(array); newLabels(array)
+*/
+void recognition::updateCollectedFaces(const vector<Mat> newFaces, const vector<int> newLabels)
+{
+    if (newFaces.empty()){
+        return;
+    }
+    //nothing to update yet, fall back to a full train
+    if (subspace.empty()){
+        learnCollectedFaces(newFaces, newLabels);
+        return;
+    }
+
+    try{
+        int n = subspace.samples;
+        int m = (int)newFaces.size();
+        int k = subspace.eigenvectors.cols;
+        Mat data = toRowMatrix(newFaces, CV_64F);
+        int d = data.cols;
+
+        Mat newMean;
+        reduce(data, newMean, 0, CV_REDUCE_AVG);
+        Mat mean = (subspace.mean * n + newMean * m) / (double)(n + m);
+
+        //centred new faces plus the shift between the old and new mean
+        Mat centred(m + 1, d, CV_64F);
+        for (int i = 0; i < m; i++){
+            Mat row = centred.row(i);
+            subtract(data.row(i), newMean, row);
+        }
+        Mat shiftRow = centred.row(m);
+        Mat meanShift = (newMean - subspace.mean) * sqrt(n * m / (double)(n + m));
+        meanShift.copyTo(shiftRow);
+
+        //part of the new data the current basis can't represent
+        Mat residual = centred.clone();
+        if (k > 0){
+            residual -= (centred * subspace.eigenvectors) * subspace.eigenvectors.t();
+        }
+        SVD svd(residual, SVD::MODIFY_A);
+        int p = 0;
+        while (p < svd.w.rows && svd.w.at<double>(p) > MIN_EIGENVALUE){
+            p++;
+        }
+
+        //combined basis [U | residual directions]
+        Mat basis(d, k + p, CV_64F);
+        if (k > 0){
+            subspace.eigenvectors.copyTo(basis.colRange(0, k));
+        }
+        if (k + p == 0){
+            return;
+        }
+        if (p > 0){
+            Mat extra = svd.vt.rowRange(0, p).t();
+            extra.copyTo(basis.colRange(k, k + p));
+        }
+
+        //scatter of old and new data expressed in the combined basis
+        Mat coeffs = centred * basis;
+        Mat scatter = coeffs.t() * coeffs;
+        for (int j = 0; j < k; j++){
+            scatter.at<double>(j, j) += n * subspace.eigenvalues.at<double>(0, j);
+        }
+        Mat values, vectors;
+        eigen(scatter, values, vectors);
+
+        int components = 0;
+        while (components < values.rows && values.at<double>(components) > MIN_EIGENVALUE
+               && (maxComponents <= 0 || components < maxComponents)){
+            components++;
+        }
+        if (components == 0){
+            //new faces add no variance, nothing to rotate into
+            return;
+        }
+        Mat rotation = vectors.rowRange(0, components).t();     //(k+p) x components
+
+        Mat eigenvectors = basis * rotation;
+        Mat shift = (subspace.mean - mean) * eigenvectors;
+
+        //re-express stored coefficients in the rotated basis, the residual directions
+        //were orthogonal to every stored face so only the first k rows of the rotation apply
+        for (size_t i = 0; i < subspace.projections.size(); i++){
+            if (k > 0){
+                subspace.projections[i] = subspace.projections[i] * rotation.rowRange(0, k) + shift;
+            }else{
+                subspace.projections[i] = shift.clone();
+            }
+        }
+        for (int i = 0; i < m; i++){
+            subspace.projections.push_back((data.row(i) - mean) * eigenvectors);
+            subspace.labels.push_back(newLabels[i]);
+        }
+
+        subspace.mean = mean;
+        subspace.eigenvectors = eigenvectors;
+        subspace.eigenvalues = values.rowRange(0, components).t() / (double)(n + m);
+        subspace.samples = n + m;
+        cacheProjection();
+    } catch(cv::Exception &e){
+        cout << "incremental update failed: " << e.what() << endl;
+    }
+}
+
 /*
     genereate a reconstructed face by backprojecting eigenvectors and eigenvalues of given preprocessed face
     @params - FaceRecogniser ; processedFace
@@ -55,34 +284,88 @@ Ptr<FaceRecognizer> recognition::learnCollectedFaces(const vector<Mat> preproces
 */
 Mat recognition::reconstructFace(const Ptr<FaceRecognizer> model, const Mat preprocessedFace)
 {
+    scopedLatency timing(STAT_RECONSTRUCT);
     try{
         //get required data
         Mat eigenvectors = model->get<Mat>("eigenvectors");
         Mat averageFaceRow = model->get<Mat>("mean");
 
-        int faceHeight = preprocessedFace.rows;
-
-        //project input into PCA subspace
-        Mat projection = subspaceProject(eigenvectors, averageFaceRow, preprocessedFace.reshape(1,1));
-        //imshow("projection", averageFaceRow);
-
-        //generate reconstructed face back form pca
-        Mat reconstructionRow = subspaceReconstruct(eigenvectors, averageFaceRow, projection);
-
-        //convert float row matrix to a regular 8-bit image
-        //make rectangular
-        Mat reconstructionMat = reconstructionRow.reshape(1, faceHeight);
-        //convert to floating point pixels
-        Mat reconstructedFace = Mat(reconstructionMat.size(), CV_8U);
-        reconstructionMat.convertTo(reconstructedFace, CV_8U, 1, 0);        
+        return reconstruct(eigenvectors, averageFaceRow, preprocessedFace);
+    } catch(cv::Exception e){
+        cout << "error: " << endl;
+        return Mat();
+    }
+}
 
-        return reconstructedFace;
+/*
+    as above but uses the incrementally updated subspace rather than the FaceRecogniser
+    @params - processedFace
+    @returns - reconstruced Face
+*/
+Mat recognition::reconstructFace(const Mat preprocessedFace)
+{
+    scopedLatency timing(STAT_RECONSTRUCT);
+    if (subspace.empty()){
+        return Mat();
+    }
+    try{
+        return reconstruct(subspace.eigenvectors, subspace.mean, preprocessedFace);
     } catch(cv::Exception e){
         cout << "error: " << endl;
         return Mat();
     }
 }
 
+/*
+    project into the eigenfaces and back again
+    @params - eigenvectors; mean; processedFace
+    @returns - reconstructed 8-bit face
+*/
+Mat recognition::reconstruct(const Mat eigenvectors, const Mat averageFaceRow, const Mat preprocessedFace)
+{
+    int faceHeight = preprocessedFace.rows;
+
+    //project input into PCA subspace
+    Mat projection = subspaceProject(eigenvectors, averageFaceRow, preprocessedFace.reshape(1,1));
+    //imshow("projection", averageFaceRow);
+
+    //generate reconstructed face back form pca
+    Mat reconstructionRow = subspaceReconstruct(eigenvectors, averageFaceRow, projection);
+
+    //convert float row matrix to a regular 8-bit image
+    //make rectangular
+    Mat reconstructionMat = reconstructionRow.reshape(1, faceHeight);
+    //convert to floating point pixels
+    Mat reconstructedFace = Mat(reconstructionMat.size(), CV_8U);
+    reconstructionMat.convertTo(reconstructedFace, CV_8U, 1, 0);
+
+    return reconstructedFace;
+}
+
+/*
+    finds the closest stored face in the subspace
+    @params - processedFace
+    @returns - label of nearest face, -1 if none learnt
+*/
+int recognition::predict(const Mat preprocessedFace)
+{
+    scopedLatency timing(STAT_PREDICT);
+    if (subspace.empty() || subspace.eigenvectors.empty() || subspace.projections.empty()){
+        return -1;
+    }
+    Mat query = subspaceProject(subspace.eigenvectors, subspace.mean, preprocessedFace.reshape(1, 1));
+    double minDist = DBL_MAX;
+    int label = -1;
+    for (size_t i = 0; i < subspace.projections.size(); i++){
+        double dist = norm(subspace.projections[i], query, NORM_L2);
+        if (dist < minDist){
+            minDist = dist;
+            label = subspace.labels[i];
+        }
+    }
+    return label;
+}
+
 /*
     compare 2 images by getting the L2 error; (sqrt of sum of squared error)
     @params - reconstructed face; capturedface
@@ -90,6 +373,7 @@ Mat recognition::reconstructFace(const Ptr<FaceRecognizer> model, const Mat prep
 */
 double recognition::getSimilarity(const Mat A, const Mat B)
 {
+    scopedLatency timing(STAT_SIMILARITY);
     if (A.rows > 0 && A.rows == B.rows && A.cols > 0 && A.cols == B.cols){
         //Calculate the L2 relative error
         double errorL2 = norm(A,B,CV_L2);
@@ -99,6 +383,337 @@ double recognition::getSimilarity(const Mat A, const Mat B)
     }
     else{
         cout << "images have diff size" << endl;
-        return 100000000.0;
+        return NO_SIMILARITY;
+    }
+}
+
+/*
+    reconstruction error from the coefficients alone: with orthonormal eigenfaces
+    |c - W W'c|^2 = |c|^2 - |W'c|^2 for the centred face c, so one pass centres the face
+    and k dot products give both the coefficients and the error. The reconstruction isn't
+    rounded to 8 bits, so results differ from the image path by that rounding
+    @params - processedFace(CV_8U or CV_32F); coefficients(optional out, 1 x k CV_32F)
+    @returns - similarity, as getSimilarity
+*/
+double recognition::reconstructionSimilarity(const Mat preprocessedFace, Mat *coefficients)
+{
+    scopedLatency timing(STAT_RESIDUAL);
+    int d = projectionMean.cols;
+    int k = projectionBasis.rows;
+    if (projectionBasis.empty() || (int)preprocessedFace.total() != d || preprocessedFace.channels() != 1
+            || !preprocessedFace.isContinuous()
+            || (preprocessedFace.depth() != CV_8U && preprocessedFace.depth() != CV_32F)){
+        //no cached model or an unusual face, take the image path
+        if (coefficients != NULL){
+            coefficients->release();
+        }
+        Mat face = preprocessedFace;
+        if (face.depth() != CV_8U){
+            face.convertTo(face, CV_8U);
+        }
+        return getSimilarity(face, reconstructFace(face));
+    }
+
+    AutoBuffer<float, CENTRED_STACK> centred(d);
+    double length;
+    if (preprocessedFace.depth() == CV_8U){
+        length = centreRow(preprocessedFace.ptr<uchar>(0), projectionMean.ptr<float>(0), centred, d);
+    }else{
+        length = centreRow(preprocessedFace.ptr<float>(0), projectionMean.ptr<float>(0), centred, d);
+    }
+
+    float *coeffs = NULL;
+    if (coefficients != NULL){
+        coefficients->create(1, k, CV_32F);
+        coeffs = coefficients->ptr<float>(0);
+    }
+    double projected = 0;
+    for (int j = 0; j < k; j++){
+        float c = dotProduct(projectionBasis.ptr<float>(j), centred, d);
+        projected += (double)c * c;
+        if (coeffs != NULL){
+            coeffs[j] = c;
+        }
+    }
+    double residual = length - projected;
+    return sqrt(residual > 0 ? residual : 0) / (double)d;
+}
+
+/*
+    batched reconstructionSimilarity and predict for a capture window: the centred faces are
+    stacked into one N x d matrix, so the basis is streamed through the cache once for the whole
+    batch instead of once per face. Nearest neighbour uses |q - p|^2 = |q|^2 + |p|^2 - 2q.p with
+    one N x n GEMM for the dot products. Faces the fused path can't take are scored one at a time
+    @params - processedFaces; similarities(out); labels(out, -1 if nothing learnt);
+              coefficients(optional out, 1 x k CV_32F per face, empty for faces scored one at a time)
+*/
+void recognition::recogniseBatch(const vector<Mat> preprocessedFaces, vector<double> &similarities, vector<int> &labels,
+                                 vector<Mat> *coefficients)
+{
+    scopedLatency timing(STAT_BATCH);
+    int count = (int)preprocessedFaces.size();
+    int d = projectionMean.cols;
+    int k = projectionBasis.rows;
+    //anything not scored below stays a non match
+    similarities.assign(count, NO_SIMILARITY);
+    labels.assign(count, -1);
+    if (coefficients != NULL){
+        coefficients->assign(count, Mat());
+    }
+
+    //faces that fit the cached projection go in the batch
+    vector<int> batch;
+    for (int i = 0; i < count; i++){
+        const Mat &face = preprocessedFaces[i];
+        if (!projectionBasis.empty() && (int)face.total() == d && face.channels() == 1 && face.isContinuous()
+                && (face.depth() == CV_8U || face.depth() == CV_32F)){
+            batch.push_back(i);
+        }else{
+            similarities[i] = reconstructionSimilarity(face);
+            labels[i] = predict(face);
+        }
+    }
+    if (batch.empty()){
+        return;
+    }
+
+    try{
+        int rows = (int)batch.size();
+        Mat centred(rows, d, CV_32F);
+        vector<double> lengths(rows);
+        for (int r = 0; r < rows; r++){
+            const Mat &face = preprocessedFaces[batch[r]];
+            if (face.depth() == CV_8U){
+                lengths[r] = centreRow(face.ptr<uchar>(0), projectionMean.ptr<float>(0), centred.ptr<float>(r), d);
+            }else{
+                lengths[r] = centreRow(face.ptr<float>(0), projectionMean.ptr<float>(0), centred.ptr<float>(r), d);
+            }
+        }
+
+        //rows x k coefficients in one GEMM
+        Mat projected;
+        gemm(centred, projectionBasis, 1.0, noArray(), 0.0, projected, GEMM_2_T);
+
+        //rows x n dot products with every stored face
+        Mat distances;
+        if (!projectionFaces.empty()){
+            gemm(projected, projectionFaces, -2.0, noArray(), 0.0, distances, GEMM_2_T);
+        }
+
+        for (int r = 0; r < rows; r++){
+            int i = batch[r];
+            const float *coeffs = projected.ptr<float>(r);
+            double length = 0;
+            for (int j = 0; j < k; j++){
+                length += (double)coeffs[j] * coeffs[j];
+            }
+            double residual = lengths[r] - length;
+            similarities[i] = sqrt(residual > 0 ? residual : 0) / (double)d;
+
+            if (!distances.empty()){
+                const float *row = distances.ptr<float>(r);
+                const float *norms = projectionNorms.ptr<float>(0);
+                float best = FLT_MAX;
+                for (int j = 0; j < distances.cols; j++){
+                    float dist = row[j] + norms[j];
+                    if (dist < best){
+                        best = dist;
+                        labels[i] = subspace.labels[j];
+                    }
+                }
+            }
+            if (coefficients != NULL){
+                (*coefficients)[i] = projected.row(r);
+            }
+        }
+    } catch(cv::Exception &e){
+        cout << "batch recognition failed: " << e.what() << endl;
+        //fail closed, entries written before the throw are not trusted either
+        for (size_t r = 0; r < batch.size(); r++){
+            similarities[batch[r]] = NO_SIMILARITY;
+            labels[batch[r]] = -1;
+            if (coefficients != NULL){
+                (*coefficients)[batch[r]] = Mat();
+            }
+        }
+    }
+}
+
+/*
+    writes the subspace to a binary model file, written to a temp file and renamed
+    so a power cut never leaves a half written model behind
+    @params - filename; stamp(fingerprint of the training images)
+    @returns - true on success
+*/
+bool recognition::saveModel(const string filename, uint64_t stamp)
+{
+    if (subspace.empty() || subspace.eigenvectors.empty()){
+        return false;
+    }
+
+    modelHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MODEL_MAGIC, sizeof(header.magic));
+    header.version = MODEL_VERSION;
+    header.stamp = stamp;
+    header.dims = subspace.eigenvectors.rows;
+    header.components = subspace.eigenvectors.cols;
+    header.faces = (int32_t)subspace.projections.size();
+    header.samples = subspace.samples;
+
+    string tmpName = filename + ".tmp";
+    FILE *file = fopen(tmpName.c_str(), "wb");
+    if (file == NULL){
+        fprintf(stderr, "Could not write model file: %s\n", tmpName.c_str());
+        return false;
+    }
+
+    char padding[MODEL_DATA_OFFSET];
+    memset(padding, 0, sizeof(padding));
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = ok && fwrite(padding, MODEL_DATA_OFFSET - sizeof(header), 1, file) == 1;
+
+    //Mats may be views so write them row by row
+    Mat eigenvalues = subspace.eigenvalues.reshape(1, 1);
+    ok = ok && fwrite(subspace.mean.ptr<double>(0), sizeof(double), header.dims, file) == (size_t)header.dims;
+    ok = ok && fwrite(eigenvalues.ptr<double>(0), sizeof(double), header.components, file) == (size_t)header.components;
+    for (int i = 0; ok && i < header.dims; i++){
+        ok = fwrite(subspace.eigenvectors.ptr<double>(i), sizeof(double), header.components, file) == (size_t)header.components;
+    }
+    for (int i = 0; ok && i < header.faces; i++){
+        ok = fwrite(subspace.projections[i].ptr<double>(0), sizeof(double), header.components, file) == (size_t)header.components;
+    }
+    for (int i = 0; ok && i < header.faces; i++){
+        int32_t label = subspace.labels[i];
+        ok = fwrite(&label, sizeof(label), 1, file) == 1;
+    }
+
+    ok = ok && fflush(file) == 0 && fsync(fileno(file)) == 0;
+    ok = (fclose(file) == 0) && ok;
+    if (!ok || rename(tmpName.c_str(), filename.c_str()) != 0){
+        fprintf(stderr, "Could not write model file: %s\n", filename.c_str());
+        remove(tmpName.c_str());
+        return false;
+    }
+    return true;
+}
+
+/*
+    checks count items of each bytes fit in what is left of a model file and takes them off,
+    never forming a product that could wrap a 32 bit size_t
+    @params - available(bytes left, updated); count; each(bytes per item, non zero)
+    @returns - false if they don't fit
+*/
+static bool takeBytes(size_t &available, size_t count, size_t each)
+{
+    if (count > available / each){
+        return false;
+    }
+    available -= count * each;
+    return true;
+}
+
+/*
+    memory-maps a model file written by saveModel and points the subspace straight at it,
+    nothing is decoded or retrained. The file is rejected if it was built from different gallery images.
+    The header is checked before any size is computed from it, so a damaged one can't make the
+    Mats reach past the mapping
+    @params - filename; stamp(fingerprint of the current training images); dims(pixels per face)
+    @returns - true if the subspace was loaded
+*/
+bool recognition::loadModel(const string filename, uint64_t stamp, int dims)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0){
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (off_t)(size_t)info.st_size != info.st_size || (size_t)info.st_size < MODEL_DATA_OFFSET){
+        close(fd);
+        return false;
+    }
+    size_t size = info.st_size;
+    void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED){
+        return false;
+    }
+
+    const modelHeader *header = (const modelHeader*)mapping;
+    bool valid = memcmp(header->magic, MODEL_MAGIC, sizeof(header->magic)) == 0 && header->version == MODEL_VERSION
+            && header->stamp == stamp && dims > 0 && header->dims == dims && header->components > 0
+            && (maxComponents <= 0 || header->components <= maxComponents) && header->faces >= 0;
+    size_t d = valid ? header->dims : 0;
+    size_t k = valid ? header->components : 0;
+    size_t n = valid ? header->faces : 0;
+    //mean, eigenvalues, eigenvectors, then a projection and a label per face must fill the file exactly
+    size_t available = size - MODEL_DATA_OFFSET;
+    valid = valid && takeBytes(available, d, sizeof(double)) && takeBytes(available, k, sizeof(double))
+            && takeBytes(available, d, k * sizeof(double)) && takeBytes(available, n, k * sizeof(double) + sizeof(int32_t))
+            && available == 0;
+    if (!valid){
+        //stale or damaged, caller retrains from the gallery
+        munmap(mapping, size);
+        return false;
+    }
+
+    double *data = (double*)((char*)mapping + MODEL_DATA_OFFSET);
+    faceSubspace loaded;
+    loaded.mean = Mat(1, (int)d, CV_64F, data);
+    data += d;
+    loaded.eigenvalues = Mat(1, (int)k, CV_64F, data);
+    data += k;
+    loaded.eigenvectors = Mat((int)d, (int)k, CV_64F, data);
+    data += d * k;
+    for (size_t i = 0; i < n; i++){
+        loaded.projections.push_back(Mat(1, (int)k, CV_64F, data));
+        data += k;
+    }
+    const int32_t *labels = (const int32_t*)data;
+    loaded.labels.assign(labels, labels + n);
+    loaded.samples = header->samples;
+
+    subspace = loaded;
+    cacheProjection();
+    unmapModel();
+    mappedModel = mapping;
+    mappedSize = size;
+    return true;
+}
+
+void recognition::unmapModel()
+{
+    if (mappedModel != NULL){
+        munmap(mappedModel, mappedSize);
+        mappedModel = NULL;
+        mappedSize = 0;
+    }
+}
+
+/*
+    FNV-1a hash of each gallery file's name, size and modification time,
+    any re-enrolment changes it and invalidates the saved model
+    @params - files(gallery image paths)
+    @returns - fingerprint
+*/
+uint64_t recognition::galleryStamp(const vector<string> files)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < files.size(); i++){
+        struct stat info;
+        int64_t fields[2] = {-1, -1};
+        if (stat(files[i].c_str(), &info) == 0){
+            fields[0] = info.st_size;
+            fields[1] = info.st_mtime;
+        }
+        const unsigned char *bytes = (const unsigned char*)files[i].c_str();
+        for (size_t j = 0; j < files[i].size(); j++){
+            hash = (hash ^ bytes[j]) * 1099511628211ULL;
+        }
+        bytes = (const unsigned char*)fields;
+        for (size_t j = 0; j < sizeof(fields); j++){
+            hash = (hash ^ bytes[j]) * 1099511628211ULL;
+        }
     }
+    return hash;
 }
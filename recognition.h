@@ -3,9 +3,25 @@
 
 #include"opencv2/opencv.hpp"
 
+#include <stdint.h>
+
 using namespace cv;
 using namespace std;
 
+// Eigenfaces model mirrored out of the FaceRecognizer so it can be updated in place.
+struct faceSubspace
+{
+    Mat mean;                   // 1 x d average face (CV_64F)
+    Mat eigenvectors;           // d x k basis, one eigenface per column (CV_64F)
+    Mat eigenvalues;            // 1 x k variance along each eigenface
+    vector<Mat> projections;    // 1 x k coefficients of every training face
+    vector<int> labels;
+    int samples;                // number of faces folded into mean and basis
+
+    faceSubspace() : samples(0) {}
+    bool empty() const { return mean.empty(); }
+};
+
 class recognition
 {
 public:
@@ -14,11 +30,55 @@ public:
     Ptr<FaceRecognizer> learnCollectedFaces(const vector<Mat> preprocessedFaces, const vector<int> faceLabels,
                                             const string facerecAlgorithm = "FaceRecognizer.Eigenfaces");
 
+    // Fold new faces into the current mean & eigenbasis (incremental PCA) instead of retraining from scratch.
+    void updateCollectedFaces(const vector<Mat> newFaces, const vector<int> newLabels);
+
     // Generate an approximately reconstructed face by back-projecting the eigenvectors & eigenvalues of the given (preprocessed) face.
     Mat reconstructFace(const Ptr<FaceRecognizer> model, const Mat preprocessedFace);
+    Mat reconstructFace(const Mat preprocessedFace);
+
+    // Nearest neighbour label in the current subspace, -1 if nothing has been learnt.
+    int predict(const Mat preprocessedFace);
 
     // Compare two images by getting the L2 error (square-root of sum of squared error).
     double getSimilarity(const Mat A, const Mat B);
+
+    // Same measure as getSimilarity(face, reconstructFace(face)) but taken straight from the subspace
+    // coefficients, without building the reconstructed image. Takes 8-bit or float faces and can
+    // return the 1 x k float coefficients for the gallery search.
+    double reconstructionSimilarity(const Mat preprocessedFace, Mat *coefficients = NULL);
+
+    // Scores N faces at once: stacks them into one matrix, projects with a single GEMM and finds each
+    // face's nearest stored face with a second one. Outputs are per face, in input order.
+    void recogniseBatch(const vector<Mat> preprocessedFaces, vector<double> &similarities, vector<int> &labels,
+                        vector<Mat> *coefficients = NULL);
+
+    // Persist the subspace as a flat binary file that is memory-mapped back at startup.
+    bool saveModel(const string filename, uint64_t stamp);
+    // dims is the pixel count of the faces in use, a model for any other size is rejected
+    bool loadModel(const string filename, uint64_t stamp, int dims);
+    // Fingerprint (name, size, mtime) of the gallery images a saved model was trained from.
+    static uint64_t galleryStamp(const vector<string> files);
+
+    faceSubspace subspace;
+    int maxComponents;          // cap on eigenfaces kept by training and incremental updates, fixes the gallery index width
+
+private:
+    void unmapModel();
+    void *mappedModel;
+    size_t mappedSize;
+
+    void syncSubspace(const Ptr<FaceRecognizer> model, int samples);
+    void cacheProjection();
+    Mat projectionBasis;        // k x d float eigenfaces, one per row so each coefficient is a contiguous dot product
+    Mat projectionMean;         // 1 x d float mean face
+    Mat projectionFaces;        // n x k float stored projections, for batched nearest neighbour
+    Mat projectionNorms;        // 1 x n squared length of each stored projection
+    Mat reconstruct(const Mat eigenvectors, const Mat averageFaceRow, const Mat preprocessedFace);
+
+    //a copy would unmap the model out from under the original
+    recognition(const recognition&);
+    recognition &operator=(const recognition&);
 };
 
 #endif // RECOGNITION_H
@@ -0,0 +1,410 @@
+#include "service.h"
+#include "stats.h"
+
+#include "opencv2/highgui/highgui.hpp"
+
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+using namespace cv;
+using namespace std;
+
+const float SERVICE_THRESHOLD = 0.7f;
+const int SERVICE_BATCH_WAIT = 2;           //ms, a little latency per request buys GEMM sized batches under load
+const int SERVICE_BACKLOG = 32;             //requests read ahead of the pipeline before connections stop being read
+const int SERVICE_LINE = 256;               //longest request line
+const int SERVICE_MAX_BYTES = 16 * 1024 * 1024;     //largest payload
+const int SERVICE_READ = 64 * 1024;
+const int SERVICE_POLL = 250;               //ms between checks of the stop flag while idle
+const int SERVICE_RESULT_WAIT = 1;          //ms to wait for a result while requests are in flight
+
+static volatile sig_atomic_t serviceStopping = 0;
+
+static void stopService(int signal)
+{
+    (void)signal;
+    serviceStopping = 1;
+}
+
+recognitionService::recognitionService(detectObject &detection, recognition &faceRecognition, faceGallery &gallery,
+                                       QReadWriteLock *modelLock)
+    : gallery(gallery), pipeline(detection, faceRecognition, &gallery, modelLock)
+{
+    threshold = SERVICE_THRESHOLD;
+    batchWait = SERVICE_BATCH_WAIT;
+    listenSocket = -1;
+    nextClient = 0;
+    answered = 0;
+}
+
+recognitionService::~recognitionService()
+{
+    pipeline.stop();
+    while (!clients.empty()){
+        closeClient(clients.begin()->first);
+    }
+    if (listenSocket >= 0){
+        close(listenSocket);
+        unlink(socketPath.c_str());
+    }
+}
+
+/*
+  opens the socket, starts the pipeline and serves connections until SIGINT or SIGTERM
+  @params - socketPath; detectWorkers, alignWorkers(pipeline threads, recognition has one)
+  @returns - requests answered, -1 if the socket couldn't be opened
+*/
+int recognitionService::run(const string socketPath, int detectWorkers, int alignWorkers)
+{
+    if (!listenOn(socketPath)){
+        return -1;
+    }
+    serviceStopping = 0;
+    void (*oldInt)(int) = signal(SIGINT, stopService);
+    void (*oldTerm)(int) = signal(SIGTERM, stopService);
+
+    //requests are unrelated images, search every one in full
+    pipeline.tracker.refreshInterval = 0;
+    pipeline.batchWait = batchWait;
+    pipeline.start(detectWorkers, alignWorkers, 1);
+    answered = 0;
+    cout << "Serving recognition on " << socketPath << " (" << gallery.size() << " faces, "
+         << detectWorkers << " detect / " << alignWorkers << " align threads)" << endl;
+
+    vector<pollfd> fds;
+    vector<int> ids;
+    while (!serviceStopping){
+        fds.clear();
+        ids.clear();
+        pollfd fd;
+        fd.fd = listenSocket;
+        fd.events = POLLIN;
+        fd.revents = 0;
+        fds.push_back(fd);
+        ids.push_back(-1);
+        bool backlog = (int)waiting.size() >= SERVICE_BACKLOG;
+        for (map<int, serviceClient>::iterator it = clients.begin(); it != clients.end(); ++it){
+            fd.fd = it->second.socket;
+            fd.events = (it->second.reading && !backlog ? POLLIN : 0) | (it->second.output.empty() ? 0 : POLLOUT);
+            fd.revents = 0;
+            fds.push_back(fd);
+            ids.push_back(it->first);
+        }
+
+        //results arrive on the pipeline threads, only sleep in poll while nothing is in flight
+        bool busy = !waiting.empty() || !submitted.empty();
+        if (poll(&fds[0], fds.size(), busy ? 0 : SERVICE_POLL) < 0 && errno != EINTR){
+            fprintf(stderr, "Recognition service poll failed: %s\n", strerror(errno));
+            break;
+        }
+        if (fds[0].revents & POLLIN){
+            acceptClient();
+        }
+        for (size_t i = 1; i < fds.size(); i++){
+            map<int, serviceClient>::iterator it = clients.find(ids[i]);
+            if (it == clients.end()){
+                continue;
+            }
+            serviceClient &client = it->second;
+            bool ok = true;
+            if (client.reading && (fds[i].revents & (POLLIN | POLLHUP | POLLERR))){
+                ok = readClient(client, ids[i]);
+            }
+            if (ok && (fds[i].revents & POLLOUT)){
+                ok = flush(client);
+            }
+            if (!ok){
+                closeClient(ids[i]);
+            }
+        }
+
+        submit();
+        answer(busy ? SERVICE_RESULT_WAIT : 0);
+
+        //connections that shut down are closed once everything they asked for has been sent
+        vector<int> finished;
+        for (map<int, serviceClient>::iterator it = clients.begin(); it != clients.end(); ++it){
+            if (!it->second.reading && it->second.outstanding == 0 && it->second.output.empty()){
+                finished.push_back(it->first);
+            }
+        }
+        for (size_t i = 0; i < finished.size(); i++){
+            closeClient(finished[i]);
+        }
+    }
+
+    pipeline.stop();
+    waiting.clear();
+    submitted.clear();
+    while (!clients.empty()){
+        closeClient(clients.begin()->first);
+    }
+    close(listenSocket);
+    listenSocket = -1;
+    unlink(socketPath.c_str());
+    signal(SIGINT, oldInt);
+    signal(SIGTERM, oldTerm);
+    cout << "Recognition service stopped after " << answered << " requests" << endl;
+    return answered;
+}
+
+/*
+  @params - socketPath(replaced if a stale socket is left from an earlier run)
+  @returns - false if the socket couldn't be created
+*/
+bool recognitionService::listenOn(const string socketPath)
+{
+    this->socketPath = socketPath;
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)){
+        fprintf(stderr, "Service socket path too long: %s\n", socketPath.c_str());
+        return false;
+    }
+    strcpy(address.sun_path, socketPath.c_str());
+    if (!removeStaleSocket(socketPath)){
+        return false;
+    }
+
+    listenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenSocket < 0 || bind(listenSocket, (sockaddr*)&address, sizeof(address)) < 0 ||
+            listen(listenSocket, SOMAXCONN) < 0){
+        fprintf(stderr, "Could not open service socket %s: %s\n", socketPath.c_str(), strerror(errno));
+        if (listenSocket >= 0){
+            close(listenSocket);
+            listenSocket = -1;
+        }
+        return false;
+    }
+    return true;
+}
+
+void recognitionService::acceptClient()
+{
+    int socket = accept(listenSocket, NULL, NULL);
+    if (socket < 0){
+        return;
+    }
+    //the loop serves every connection, none of them may block it
+    fcntl(socket, F_SETFL, fcntl(socket, F_GETFL, 0) | O_NONBLOCK);
+    serviceClient client;
+    client.socket = socket;
+    clients[nextClient++] = client;
+}
+
+/*
+  reads what the connection has sent and queues the complete requests in it
+  @params - client; id
+  @returns - false if the connection failed and should be closed
+*/
+bool recognitionService::readClient(serviceClient &client, int id)
+{
+    static char buffer[SERVICE_READ];
+    ssize_t count = recv(client.socket, buffer, sizeof(buffer), 0);
+    if (count < 0){
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    }
+    if (count == 0){
+        //shut down for writing, a partial request is dropped but the rest still get answers
+        client.reading = false;
+        client.input.clear();
+        return true;
+    }
+    client.input.append(buffer, count);
+    parse(client, id);
+    return true;
+}
+
+/*
+  splits the input into requests, a malformed line is answered with ERROR and ends reading
+  since the next request can't be found without its length
+  @params - client; id
+*/
+void recognitionService::parse(serviceClient &client, int id)
+{
+    while (client.reading){
+        size_t end = client.input.find('\n');
+        if (end == string::npos && client.input.size() <= (size_t)SERVICE_LINE){
+            return;     //rest of the line still to come
+        }
+        serviceRequest request;
+        request.client = id;
+        request.timer.start();
+
+        string command, format;
+        long length = -1;
+        istringstream line(client.input.substr(0, min(end, (size_t)SERVICE_LINE)));
+        line >> command;
+        if (command == "VERIFY"){
+            request.command = SERVICE_VERIFY;
+            line >> request.user;
+        }
+        line >> format >> length;
+        if (end == string::npos || line.fail() || (command != "IDENTIFY" && command != "VERIFY") ||
+                (format != "IMAGE" && format != "FACE") || length < 0 || length > SERVICE_MAX_BYTES){
+            request.error = "bad request";
+            client.reading = false;
+            client.input.clear();
+        }else if (client.input.size() - (end + 1) < (size_t)length){
+            return;     //payload still to come
+        }else{
+            string payload = client.input.substr(end + 1, length);
+            client.input.erase(0, end + 1 + length);
+            request.preprocessed = format == "FACE";
+            if (request.command == SERVICE_VERIFY &&
+                    find(gallery.names.begin(), gallery.names.end(), request.user) == gallery.names.end()){
+                request.error = "unknown user " + request.user;
+            }else{
+                request.image = decode(payload, request.preprocessed, request.error);
+            }
+        }
+        client.outstanding++;
+        waiting.push_back(request);
+    }
+}
+
+/*
+  @params - payload; preprocessed(face rather than image); error(out, set if it can't be used)
+  @returns - BGR image, or the grey face
+*/
+Mat recognitionService::decode(const string &payload, bool preprocessed, string &error)
+{
+    if (preprocessed && payload.size() == (size_t)(FACE_WIDTH * FACE_WIDTH)){
+        //raw pixels
+        Mat face(FACE_WIDTH, FACE_WIDTH, CV_8U);
+        memcpy(face.data, payload.data(), payload.size());
+        return face;
+    }
+    Mat image;
+    try{
+        vector<uchar> bytes(payload.begin(), payload.end());
+        image = imdecode(bytes, preprocessed ? CV_LOAD_IMAGE_GRAYSCALE : CV_LOAD_IMAGE_COLOR);
+    }catch(cv::Exception &e){
+        image = Mat();
+    }
+    if (image.empty()){
+        error = "could not decode image";
+    }else if (preprocessed && (image.cols != FACE_WIDTH || image.rows != FACE_WIDTH)){
+        ostringstream message;
+        message << "face must be " << FACE_WIDTH << "x" << FACE_WIDTH;
+        error = message.str();
+        image = Mat();
+    }
+    return image;
+}
+
+/*
+  hands waiting requests to the pipeline in the order they were read, stops at the first
+  one it has no room for so each connection's answers stay in order
+*/
+void recognitionService::submit()
+{
+    while (!waiting.empty()){
+        serviceRequest &request = waiting.front();
+        if (request.error.empty()){
+            bool queued = request.preprocessed ? pipeline.submitFace(request.image, 0) : pipeline.submit(request.image, 0);
+            if (!queued){
+                return;
+            }
+            request.image.release();    //the pipeline holds its own reference
+        }
+        submitted.push_back(request);
+        waiting.pop_front();
+    }
+}
+
+/*
+  answers submitted requests in order, the pipeline returns results in the order they were submitted
+  @params - timeout(ms to wait for the first result)
+*/
+void recognitionService::answer(int timeout)
+{
+    pipelineItem item;
+    while (!submitted.empty()){
+        const serviceRequest &request = submitted.front();
+        if (!request.error.empty()){
+            respond(request, "ERROR " + request.error);
+        }else if (pipeline.nextResult(item, timeout)){
+            respond(request, result(request, item));
+            timeout = 0;
+        }else{
+            return;
+        }
+        submitted.pop_front();
+    }
+}
+
+/*
+  @params - request; item(its pipeline result)
+  @returns - response line, a verify only matches if the nearest enrolled face is the claimed user
+*/
+string recognitionService::result(const serviceRequest &request, const pipelineItem &item)
+{
+    if (item.face.empty()){
+        return "NOFACE";
+    }
+    string name = gallery.name(item.identity);
+    bool matched = item.identity >= 0 && item.similarity < threshold;
+    if (request.command == SERVICE_VERIFY){
+        matched = matched && name == request.user;
+    }
+    ostringstream line;
+    line << (matched ? "MATCH " : "NOMATCH ") << item.identity << " " << name << " "
+         << fixed << setprecision(4) << item.similarity;
+    return line.str();
+}
+
+void recognitionService::respond(const serviceRequest &request, const string &line)
+{
+    stageStats.record(STAT_SERVICE_REQUEST, request.timer.nsecsElapsed());
+    answered++;
+    map<int, serviceClient>::iterator it = clients.find(request.client);
+    if (it == clients.end()){
+        return;     //connection went away
+    }
+    it->second.outstanding--;
+    it->second.output += line + "\n";
+    if (!flush(it->second)){
+        closeClient(request.client);
+    }
+}
+
+/*
+  sends as much of the pending output as the socket takes
+  @params - client
+  @returns - false if the connection failed
+*/
+bool recognitionService::flush(serviceClient &client)
+{
+    while (!client.output.empty()){
+        ssize_t written = send(client.socket, client.output.data(), client.output.size(), MSG_NOSIGNAL);
+        if (written < 0){
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        }
+        client.output.erase(0, written);
+    }
+    return true;
+}
+
+void recognitionService::closeClient(int id)
+{
+    map<int, serviceClient>::iterator it = clients.find(id);
+    if (it == clients.end()){
+        return;
+    }
+    close(it->second.socket);
+    clients.erase(it);
+}
@@ -0,0 +1,102 @@
+#ifndef SERVICE_H
+#define SERVICE_H
+
+#include "detectobject.h"
+#include "recognition.h"
+#include "gallery.h"
+#include "pipeline.h"
+
+#include "opencv2/core/core.hpp"
+
+#include <QReadWriteLock>
+
+#include <deque>
+#include <map>
+#include <string>
+
+using namespace cv;
+using namespace std;
+
+enum serviceCommand { SERVICE_IDENTIFY, SERVICE_VERIFY };
+
+/*
+  One request line, followed by <bytes> of payload:
+    IDENTIFY IMAGE|FACE <bytes>
+    VERIFY <name> IMAGE|FACE <bytes>
+  IMAGE is an encoded image (png, jpeg...) that is searched for a face, FACE an already
+  preprocessed face, either encoded or FACE_WIDTH x FACE_WIDTH raw grey bytes.
+  Every request gets one line back, in the order the connection sent them:
+    MATCH|NOMATCH <label> <name> <similarity>
+    NOFACE
+    ERROR <reason>
+*/
+struct serviceRequest
+{
+    int client;
+    serviceCommand command;
+    string user;            // claimed identity, VERIFY only
+    bool preprocessed;      // payload is a face, not a whole image
+    Mat image;
+    string error;           // set if the request can't be run, answered without the pipeline
+    QElapsedTimer timer;    // started once the request was read
+
+    serviceRequest() : client(-1), command(SERVICE_IDENTIFY), preprocessed(false) {}
+};
+
+// One connection: bytes read but not yet parsed, and responses not yet sent.
+struct serviceClient
+{
+    int socket;
+    string input;
+    string output;
+    int outstanding;        // requests read but not yet answered
+    bool reading;           // false once the client shut down its side
+
+    serviceClient() : socket(-1), outstanding(0), reading(true) {}
+};
+
+/*
+  Keeps the cascades, gallery and trained model resident and answers identify/verify requests
+  over a Unix domain socket, so other programs don't pay for loading and training per call.
+  Connections are served from one poll loop on the calling thread, faces from every connection
+  share one pipeline whose recognise stage scores concurrent requests in batches.
+*/
+class recognitionService
+{
+public:
+    recognitionService(detectObject &detection, recognition &faceRecognition, faceGallery &gallery,
+                       QReadWriteLock *modelLock = NULL);
+    ~recognitionService();
+
+    // serves until SIGINT or SIGTERM, returns the number of requests answered, -1 if the socket can't be opened
+    int run(const string socketPath, int detectWorkers, int alignWorkers);
+
+    double threshold;           // similarity below this counts as a match
+    int batchWait;              // ms the recognise stage holds a face for others to batch with
+
+private:
+    bool listenOn(const string socketPath);
+    void acceptClient();
+    bool readClient(serviceClient &client, int id);
+    void parse(serviceClient &client, int id);
+    void submit();
+    void answer(int timeout);
+    void respond(const serviceRequest &request, const string &line);
+    bool flush(serviceClient &client);
+    void closeClient(int id);
+    string result(const serviceRequest &request, const pipelineItem &item);
+    Mat decode(const string &payload, bool preprocessed, string &error);
+
+    faceGallery &gallery;
+    recognitionPipeline pipeline;
+
+    string socketPath;
+    int listenSocket;
+    int nextClient;
+    map<int, serviceClient> clients;
+    deque<serviceRequest> waiting;      // read, not yet taken by the pipeline
+    deque<serviceRequest> submitted;    // in the pipeline (or failed), answered in this order
+    int answered;
+};
+
+#endif // SERVICE_H
@@ -0,0 +1,252 @@
+#include "simdkernels.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+/*
+  blend weights for equalizeLeftAndRightHalves, in the same quarters as the reference:
+  left 25% half histogram only, then a ramp to the whole face histogram at the centre,
+  a ramp back to the half histogram and the right 25% half histogram only
+  @params - width(face width); weights(out, width entries)
+*/
+void halvesBlendWeights(int width, ushort *weights)
+{
+    for (int x = 0; x < width; x++){
+        float f;
+        if (x < width/4){
+            f = 0.0f;
+        }else if (x < width*2/4){
+            f = (x - width*1/4) / (float)(width*0.25f);
+        }else if (x < width*3/4){
+            f = 1.0f - (x - width*2/4) / (float)(width*0.25f);
+        }else{
+            f = 0.0f;
+        }
+        weights[x] = (ushort)floor(f * BLEND_ONE + 0.5f);
+    }
+}
+
+void blendRow(const uchar *halves, const uchar *whole, const ushort *weights, uchar *dst, int width)
+{
+    blendPixels(halves, whole, weights, dst, width);
+}
+
+/*
+  subtracts the mean face from a face, the first half of projecting it into the eigenfaces
+  the squares are summed in double, they are differenced against the projection later
+  @params - src(face pixels); mean(mean face); dst(out, centred face); length(pixels)
+  @returns - squared length of the centred face
+*/
+double centreRow(const uchar *src, const float *mean, float *dst, int length)
+{
+    int x = 0;
+    double sum = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+    for (; x + 8 <= length; x += 8){
+        __m128i pixels = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(src + x)), zero);
+        __m128 lo = _mm_sub_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(pixels, zero)), _mm_loadu_ps(mean + x));
+        __m128 hi = _mm_sub_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(pixels, zero)), _mm_loadu_ps(mean + x + 4));
+        _mm_storeu_ps(dst + x, lo);
+        _mm_storeu_ps(dst + x + 4, hi);
+        __m128 sq = _mm_add_ps(_mm_mul_ps(lo, lo), _mm_mul_ps(hi, hi));
+        acc0 = _mm_add_pd(acc0, _mm_cvtps_pd(sq));
+        acc1 = _mm_add_pd(acc1, _mm_cvtps_pd(_mm_movehl_ps(sq, sq)));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+    sum = lanes[0] + lanes[1];
+#elif defined(__ARM_NEON__)
+    //no double lanes on ARMv7, flush the float lanes to double every 8 pixels
+    for (; x + 8 <= length; x += 8){
+        uint16x8_t pixels = vmovl_u8(vld1_u8(src + x));
+        float32x4_t lo = vsubq_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(pixels))), vld1q_f32(mean + x));
+        float32x4_t hi = vsubq_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(pixels))), vld1q_f32(mean + x + 4));
+        vst1q_f32(dst + x, lo);
+        vst1q_f32(dst + x + 4, hi);
+        float32x4_t sq = vmlaq_f32(vmulq_f32(lo, lo), hi, hi);
+        float32x2_t pair = vadd_f32(vget_low_f32(sq), vget_high_f32(sq));
+        sum += (double)vget_lane_f32(vpadd_f32(pair, pair), 0);
+    }
+#endif
+    for (; x < length; x++){
+        dst[x] = src[x] - mean[x];
+        sum += (double)dst[x] * dst[x];
+    }
+    return sum;
+}
+
+double centreRow(const float *src, const float *mean, float *dst, int length)
+{
+    int x = 0;
+    double sum = 0;
+#if defined(__SSE2__)
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+    for (; x + 4 <= length; x += 4){
+        __m128 c = _mm_sub_ps(_mm_loadu_ps(src + x), _mm_loadu_ps(mean + x));
+        _mm_storeu_ps(dst + x, c);
+        __m128 sq = _mm_mul_ps(c, c);
+        acc0 = _mm_add_pd(acc0, _mm_cvtps_pd(sq));
+        acc1 = _mm_add_pd(acc1, _mm_cvtps_pd(_mm_movehl_ps(sq, sq)));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+    sum = lanes[0] + lanes[1];
+#elif defined(__ARM_NEON__)
+    for (; x + 4 <= length; x += 4){
+        float32x4_t c = vsubq_f32(vld1q_f32(src + x), vld1q_f32(mean + x));
+        vst1q_f32(dst + x, c);
+        float32x4_t sq = vmulq_f32(c, c);
+        float32x2_t pair = vadd_f32(vget_low_f32(sq), vget_high_f32(sq));
+        sum += (double)vget_lane_f32(vpadd_f32(pair, pair), 0);
+    }
+#endif
+    for (; x < length; x++){
+        dst[x] = src[x] - mean[x];
+        sum += (double)dst[x] * dst[x];
+    }
+    return sum;
+}
+
+/*
+  dot product with two accumulators to hide the add latency
+  @params - a, b(vectors); length
+  @returns - sum of a[x] * b[x]
+*/
+float dotProduct(const float *a, const float *b, int length)
+{
+    int x = 0;
+    float sum = 0;
+#if defined(__SSE2__)
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    for (; x + 8 <= length; x += 8){
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + x), _mm_loadu_ps(b + x)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + x + 4), _mm_loadu_ps(b + x + 4)));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, _mm_add_ps(acc0, acc1));
+    sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#elif defined(__ARM_NEON__)
+    float32x4_t acc0 = vdupq_n_f32(0);
+    float32x4_t acc1 = vdupq_n_f32(0);
+    for (; x + 8 <= length; x += 8){
+        acc0 = vmlaq_f32(acc0, vld1q_f32(a + x), vld1q_f32(b + x));
+        acc1 = vmlaq_f32(acc1, vld1q_f32(a + x + 4), vld1q_f32(b + x + 4));
+    }
+    float32x4_t acc = vaddq_f32(acc0, acc1);
+    float32x2_t pair = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+    sum = vget_lane_f32(vpadd_f32(pair, pair), 0);
+#endif
+    for (; x < length; x++){
+        sum += a[x] * b[x];
+    }
+    return sum;
+}
+
+void maskRow(const uchar *src, const uchar *mask, uchar fill, uchar *dst, int width)
+{
+    maskPixels(src, mask, fill, dst, width);
+}
+
+/*
+  bilateral filter for 8 neighbouring pixels at once, a tap reads the 8 pixels at the same offset
+  with one load. The colour weights are a table lookup per lane, the sums are kept per lane in tap
+  order so each pixel is summed exactly as the scalar loop sums it
+  @params - centre(first pixel of the row, padded by the window radius); offsets(per tap, bytes from the centre)
+            space(weight per tap); taps; colour(weight per absolute difference, 256 entries); dst(out); width
+*/
+void bilateralRow(const uchar *centre, const int *offsets, const float *space, int taps, const float *colour,
+                  uchar *dst, int width)
+{
+    int x = 0;
+#if defined(__SSE2__) || defined(__ARM_NEON__)
+    uchar diffs[8];
+    float weights[8];
+    float sums[8];
+    float weightSums[8];
+#endif
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    for (; x + 8 <= width; x += 8){
+        __m128i centreValues = _mm_loadl_epi64((const __m128i*)(centre + x));
+        __m128 sumLo = _mm_setzero_ps();
+        __m128 sumHi = _mm_setzero_ps();
+        __m128 weightLo = _mm_setzero_ps();
+        __m128 weightHi = _mm_setzero_ps();
+        for (int k = 0; k < taps; k++){
+            __m128i values = _mm_loadl_epi64((const __m128i*)(centre + x + offsets[k]));
+            __m128i diff = _mm_sub_epi8(_mm_max_epu8(values, centreValues), _mm_min_epu8(values, centreValues));
+            _mm_storel_epi64((__m128i*)diffs, diff);
+            for (int i = 0; i < 8; i++){
+                weights[i] = colour[diffs[i]];
+            }
+            __m128 spaceWeight = _mm_set1_ps(space[k]);
+            __m128 lo = _mm_mul_ps(spaceWeight, _mm_loadu_ps(weights));
+            __m128 hi = _mm_mul_ps(spaceWeight, _mm_loadu_ps(weights + 4));
+            __m128i wide = _mm_unpacklo_epi8(values, zero);
+            sumLo = _mm_add_ps(sumLo, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(wide, zero)), lo));
+            sumHi = _mm_add_ps(sumHi, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(wide, zero)), hi));
+            weightLo = _mm_add_ps(weightLo, lo);
+            weightHi = _mm_add_ps(weightHi, hi);
+        }
+        _mm_storeu_ps(sums, sumLo);
+        _mm_storeu_ps(sums + 4, sumHi);
+        _mm_storeu_ps(weightSums, weightLo);
+        _mm_storeu_ps(weightSums + 4, weightHi);
+        for (int i = 0; i < 8; i++){
+            dst[x + i] = (uchar)lrintf(sums[i] / weightSums[i]);
+        }
+    }
+#elif defined(__ARM_NEON__)
+    for (; x + 8 <= width; x += 8){
+        uint8x8_t centreValues = vld1_u8(centre + x);
+        float32x4_t sumLo = vdupq_n_f32(0);
+        float32x4_t sumHi = vdupq_n_f32(0);
+        float32x4_t weightLo = vdupq_n_f32(0);
+        float32x4_t weightHi = vdupq_n_f32(0);
+        for (int k = 0; k < taps; k++){
+            uint8x8_t values = vld1_u8(centre + x + offsets[k]);
+            vst1_u8(diffs, vabd_u8(values, centreValues));
+            for (int i = 0; i < 8; i++){
+                weights[i] = colour[diffs[i]];
+            }
+            float32x4_t lo = vmulq_n_f32(vld1q_f32(weights), space[k]);
+            float32x4_t hi = vmulq_n_f32(vld1q_f32(weights + 4), space[k]);
+            uint16x8_t wide = vmovl_u8(values);
+            sumLo = vmlaq_f32(sumLo, vcvtq_f32_u32(vmovl_u16(vget_low_u16(wide))), lo);
+            sumHi = vmlaq_f32(sumHi, vcvtq_f32_u32(vmovl_u16(vget_high_u16(wide))), hi);
+            weightLo = vaddq_f32(weightLo, lo);
+            weightHi = vaddq_f32(weightHi, hi);
+        }
+        vst1q_f32(sums, sumLo);
+        vst1q_f32(sums + 4, sumHi);
+        vst1q_f32(weightSums, weightLo);
+        vst1q_f32(weightSums + 4, weightHi);
+        for (int i = 0; i < 8; i++){
+            dst[x + i] = (uchar)lrintf(sums[i] / weightSums[i]);
+        }
+    }
+#endif
+    for (; x < width; x++){
+        int value = centre[x];
+        float sum = 0;
+        float weightSum = 0;
+        for (int k = 0; k < taps; k++){
+            int neighbour = centre[x + offsets[k]];
+            float w = space[k] * colour[abs(neighbour - value)];
+            sum += neighbour * w;
+            weightSum += w;
+        }
+        dst[x] = (uchar)lrintf(sum / weightSum);
+    }
+}
@@ -0,0 +1,123 @@
+#ifndef SIMDKERNELS_H
+#define SIMDKERNELS_H
+
+// Low level pixel kernels, SSE2 on x86 and NEON on ARM with a scalar fallback.
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+typedef unsigned char uchar;
+typedef unsigned short ushort;
+
+// Kernels defined in this header are forced inline, so a constant length reaches their loops.
+#define KERNEL_INLINE inline __attribute__((always_inline))
+
+const int BLEND_SHIFT = 8;
+const int BLEND_ONE = 1 << BLEND_SHIFT;     // weight of 1.0 in the blend tables
+
+// Per column weight (0..BLEND_ONE) of the whole face histogram in equalizeLeftAndRightHalves.
+void halvesBlendWeights(int width, ushort *weights);
+
+// dst[x] = (halves[x] * (BLEND_ONE - weights[x]) + whole[x] * weights[x] + BLEND_ONE/2) >> BLEND_SHIFT
+// dst may be the same row as halves.
+void blendRow(const uchar *halves, const uchar *whole, const ushort *weights, uchar *dst, int width);
+
+// dst[x] = src[x] - mean[x], returns the sum of squares of dst (accumulated in double).
+double centreRow(const uchar *src, const float *mean, float *dst, int length);
+double centreRow(const float *src, const float *mean, float *dst, int length);
+
+// Sum of a[x] * b[x].
+float dotProduct(const float *a, const float *b, int length);
+
+// dst[x] = mask[x] ? src[x] : fill
+void maskRow(const uchar *src, const uchar *mask, uchar fill, uchar *dst, int width);
+
+// One row of an 8 bit bilateral filter, accumulated per pixel in the same order as cv::bilateralFilter.
+// centre is the first pixel of the row in a padded image, offsets/space are the taps of the window
+// and colour the weight per absolute grey level difference.
+void bilateralRow(const uchar *centre, const int *offsets, const float *space, int taps, const float *colour,
+                  uchar *dst, int width);
+
+// Inline bodies of blendRow and maskRow. The out of line versions take the length at run time,
+// blendFixed and maskFixed below instantiate them with a compile time length.
+
+/*
+  fixed point blend of two rows with per column weights
+  8 pixels at a time in 16 bit lanes, 255 * BLEND_ONE + BLEND_ONE/2 still fits
+  @params - halves, whole(source rows); weights(per column); dst(output row); width
+*/
+KERNEL_INLINE void blendPixels(const uchar *halves, const uchar *whole, const ushort *weights, uchar *dst, int width)
+{
+    int x = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi16(BLEND_ONE);
+    const __m128i half = _mm_set1_epi16(BLEND_ONE / 2);
+    for (; x + 8 <= width; x += 8){
+        __m128i h = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(halves + x)), zero);
+        __m128i w = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(whole + x)), zero);
+        __m128i wt = _mm_loadu_si128((const __m128i*)(weights + x));
+        __m128i sum = _mm_add_epi16(_mm_mullo_epi16(h, _mm_sub_epi16(one, wt)), _mm_mullo_epi16(w, wt));
+        sum = _mm_srli_epi16(_mm_add_epi16(sum, half), BLEND_SHIFT);
+        _mm_storel_epi64((__m128i*)(dst + x), _mm_packus_epi16(sum, zero));
+    }
+#elif defined(__ARM_NEON__)
+    const uint16x8_t one = vdupq_n_u16(BLEND_ONE);
+    for (; x + 8 <= width; x += 8){
+        uint16x8_t wt = vld1q_u16(weights + x);
+        uint16x8_t sum = vmulq_u16(vmovl_u8(vld1_u8(halves + x)), vsubq_u16(one, wt));
+        sum = vmlaq_u16(sum, vmovl_u8(vld1_u8(whole + x)), wt);
+        vst1_u8(dst + x, vrshrn_n_u16(sum, BLEND_SHIFT));
+    }
+#endif
+    for (; x < width; x++){
+        dst[x] = (uchar)((halves[x] * (BLEND_ONE - weights[x]) + whole[x] * weights[x] + BLEND_ONE/2) >> BLEND_SHIFT);
+    }
+}
+
+/*
+  masked copy onto a fill value, 16 pixels at a time
+  @params - src; mask(non zero selects src); fill; dst(out); width
+*/
+KERNEL_INLINE void maskPixels(const uchar *src, const uchar *mask, uchar fill, uchar *dst, int width)
+{
+    int x = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i fillValue = _mm_set1_epi8((char)fill);
+    for (; x + 16 <= width; x += 16){
+        __m128i unset = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(mask + x)), zero);
+        __m128i pixels = _mm_loadu_si128((const __m128i*)(src + x));
+        _mm_storeu_si128((__m128i*)(dst + x), _mm_or_si128(_mm_and_si128(unset, fillValue), _mm_andnot_si128(unset, pixels)));
+    }
+#elif defined(__ARM_NEON__)
+    const uint8x16_t fillValue = vdupq_n_u8(fill);
+    for (; x + 16 <= width; x += 16){
+        uint8x16_t selected = vld1q_u8(mask + x);
+        selected = vtstq_u8(selected, selected);
+        vst1q_u8(dst + x, vbslq_u8(selected, vld1q_u8(src + x), fillValue));
+    }
+#endif
+    for (; x < width; x++){
+        dst[x] = mask[x] ? src[x] : fill;
+    }
+}
+
+// blendRow over exactly Length pixels, the trip count and tail are known to the compiler.
+template <int Length>
+KERNEL_INLINE void blendFixed(const uchar *halves, const uchar *whole, const ushort *weights, uchar *dst)
+{
+    blendPixels(halves, whole, weights, dst, Length);
+}
+
+// maskRow over exactly Length pixels.
+template <int Length>
+KERNEL_INLINE void maskFixed(const uchar *src, const uchar *mask, uchar fill, uchar *dst)
+{
+    maskPixels(src, mask, fill, dst, Length);
+}
+
+#endif // SIMDKERNELS_H
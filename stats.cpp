@@ -0,0 +1,327 @@
+#include "stats.h"
+
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+const int POLL_INTERVAL = 250;      //ms between checks of the stop flag
+
+latencyStats stageStats;
+
+latencyHistogram::latencyHistogram()
+{
+}
+
+/*
+  values below 4us get a bucket each, above that 4 buckets per power of 2
+  @params - micros
+  @returns - bucket index
+*/
+int latencyHistogram::bucket(unsigned int micros)
+{
+    if (micros < 4){
+        return (int)micros;
+    }
+    int msb = 31 - __builtin_clz(micros);
+    int index = (msb - 1) * 4 + ((micros >> (msb - 2)) & 3);
+    return index < HIST_BUCKETS ? index : HIST_BUCKETS - 1;
+}
+
+int latencyHistogram::bucketLimit(int bucket)
+{
+    bucket++;
+    if (bucket >= HIST_BUCKETS){
+        return 0x7fffffff;
+    }
+    if (bucket < 4){
+        return bucket;
+    }
+    int msb = bucket / 4 + 1;
+    return (4 + bucket % 4) << (msb - 2);
+}
+
+void latencyHistogram::record(qint64 nsecs)
+{
+    qint64 micros = nsecs / 1000;
+    int value = micros > 0x7fffffff ? 0x7fffffff : (int)micros;
+    buckets[bucket((unsigned int)value)].fetchAndAddRelaxed(1);
+    samples.fetchAndAddRelaxed(1);
+    int current = maximum;
+    while (value > current && !maximum.testAndSetRelaxed(current, value)){
+        current = maximum;
+    }
+}
+
+int latencyHistogram::count() const
+{
+    return samples;
+}
+
+int latencyHistogram::maxMicros() const
+{
+    return maximum;
+}
+
+int latencyHistogram::percentile(double p) const
+{
+    int counts[HIST_BUCKETS];
+    int total = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++){
+        counts[i] = buckets[i];
+        total += counts[i];
+    }
+    if (total == 0){
+        return 0;
+    }
+    //rank of the sample, rounded up so p99 of 100 samples is the 99th
+    int rank = (int)(p / 100.0 * total + 0.999999);
+    rank = rank < 1 ? 1 : rank;
+    int seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++){
+        seen += counts[i];
+        if (seen >= rank){
+            int limit = bucketLimit(i);
+            return limit < maxMicros() ? limit : maxMicros();
+        }
+    }
+    return maxMicros();
+}
+
+const char *latencyStats::stageName(int stage)
+{
+    static const char *names[STAT_COUNT] = {
+        "findObject.face",
+        "findObject.leftEye",
+        "findObject.rightEye",
+        "findObject.leftEyeGlasses",
+        "findObject.rightEyeGlasses",
+        "detectEyes.warpAffine",
+        "detectEyes.bilateralFilter",
+        "reconstructFace",
+        "getSimilarity",
+        "reconstructionSimilarity",
+        "recogniseBatch",
+        "predict",
+        "learnCollectedFaces",
+        "pipeline.detect",
+        "pipeline.align",
+        "pipeline.recognise",
+        "service.request"
+    };
+    return (stage >= 0 && stage < STAT_COUNT) ? names[stage] : "unknown";
+}
+
+string latencyStats::report() const
+{
+    ostringstream out;
+    out << "# stage count p50_us p90_us p99_us max_us\n";
+    for (int i = 0; i < STAT_COUNT; i++){
+        const latencyHistogram &hist = histograms[i];
+        out << stageName(i) << " " << hist.count() << " " << hist.percentile(50) << " " << hist.percentile(90)
+            << " " << hist.percentile(99) << " " << hist.maxMicros() << "\n";
+    }
+    if (cameras > 0){
+        out << "# camera fps frames p50_us p90_us p99_us max_us\n";
+    }
+    for (int i = 0; i < cameras; i++){
+        const latencyHistogram &hist = frames[i];
+        int rate = frameRates[i];
+        out << "camera" << i << " " << rate / 10 << "." << rate % 10 << " " << hist.count() << " " << hist.percentile(50)
+            << " " << hist.percentile(90) << " " << hist.percentile(99) << " " << hist.maxMicros() << "\n";
+    }
+    return out.str();
+}
+
+statsExporter::statsExporter()
+{
+    interval = 0;
+    listenSocket = -1;
+    stopping = 0;
+}
+
+statsExporter::~statsExporter()
+{
+    stop();
+}
+
+/*
+  opens the socket and starts the export thread
+  @params - socketPath(Unix socket, "" for none); filePath(stats file, "" for none); interval(ms between file writes)
+  @returns - false if the socket couldn't be created
+*/
+bool statsExporter::start(const string socketPath, const string filePath, int interval)
+{
+    stop();
+    this->socketPath = socketPath;
+    this->filePath = filePath;
+    this->interval = interval;
+
+    if (!socketPath.empty()){
+        sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (socketPath.size() >= sizeof(address.sun_path)){
+            fprintf(stderr, "Stats socket path too long: %s\n", socketPath.c_str());
+            return false;
+        }
+        strcpy(address.sun_path, socketPath.c_str());
+        if (!removeStaleSocket(socketPath)){
+            return false;
+        }
+
+        listenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listenSocket < 0 || bind(listenSocket, (sockaddr*)&address, sizeof(address)) < 0 ||
+                listen(listenSocket, 4) < 0){
+            fprintf(stderr, "Could not open stats socket %s: %s\n", socketPath.c_str(), strerror(errno));
+            if (listenSocket >= 0){
+                close(listenSocket);
+                listenSocket = -1;
+            }
+            return false;
+        }
+    }
+    stopping = 0;
+    QThread::start(QThread::LowPriority);
+    return true;
+}
+
+void statsExporter::stop()
+{
+    if (isRunning()){
+        stopping = 1;
+        wait();
+    }
+    if (listenSocket >= 0){
+        close(listenSocket);
+        listenSocket = -1;
+        unlink(socketPath.c_str());
+    }
+}
+
+/*
+  waits on the socket, a connection gets the report and is closed straight away
+  the stats file is rewritten every interval ms
+*/
+void statsExporter::run()
+{
+    QElapsedTimer sinceWrite;
+    sinceWrite.start();
+    while (!stopping){
+        if (listenSocket >= 0){
+            pollfd fd;
+            fd.fd = listenSocket;
+            fd.events = POLLIN;
+            fd.revents = 0;
+            if (poll(&fd, 1, POLL_INTERVAL) > 0 && (fd.revents & POLLIN)){
+                serve();
+            }
+        }else{
+            msleep(POLL_INTERVAL);
+        }
+        if (!filePath.empty() && sinceWrite.elapsed() >= interval){
+            writeFile();
+            sinceWrite.restart();
+        }
+    }
+    if (!filePath.empty()){
+        writeFile();
+    }
+}
+
+void statsExporter::serve()
+{
+    int client = accept(listenSocket, NULL, NULL);
+    if (client < 0){
+        return;
+    }
+    string text = stageStats.report();
+    const char *data = text.c_str();
+    size_t left = text.size();
+    while (left > 0){
+        ssize_t written = send(client, data, left, MSG_NOSIGNAL);
+        if (written <= 0){
+            break;
+        }
+        data += written;
+        left -= written;
+    }
+    close(client);
+}
+
+/*
+  written to a temporary file and renamed, so readers never see half a report
+*/
+void statsExporter::writeFile()
+{
+    string tmpPath = filePath + ".tmp";
+    FILE *file = fopen(tmpPath.c_str(), "w");
+    if (file == NULL){
+        return;
+    }
+    string text = stageStats.report();
+    fwrite(text.data(), 1, text.size(), file);
+    fclose(file);
+    rename(tmpPath.c_str(), filePath.c_str());
+}
+
+/*
+  a socket file stays behind when a run is killed. It is only removed once connecting to it is
+  refused, so a second instance can't take the path away from one that is still serving
+  @params - path
+  @returns - true if nothing is left at path
+*/
+bool removeStaleSocket(const string path)
+{
+    struct stat info;
+    if (lstat(path.c_str(), &info) != 0){
+        if (errno == ENOENT){
+            return true;
+        }
+        fprintf(stderr, "Could not check socket %s: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+    if (!S_ISSOCK(info.st_mode)){
+        //connect() is refused for any file, only sockets are removed
+        fprintf(stderr, "%s is not a socket, not replacing it\n", path.c_str());
+        return false;
+    }
+
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+    int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (probe < 0){
+        fprintf(stderr, "Could not check socket %s: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+    int connected = connect(probe, (sockaddr*)&address, sizeof(address));
+    int error = errno;
+    close(probe);
+    if (connected == 0){
+        fprintf(stderr, "Socket %s is in use by another process\n", path.c_str());
+        return false;
+    }
+    if (error == ENOENT){
+        return true;
+    }
+    if (error != ECONNREFUSED){
+        fprintf(stderr, "Could not check socket %s: %s\n", path.c_str(), strerror(error));
+        return false;
+    }
+    if (unlink(path.c_str()) != 0 && errno != ENOENT){
+        fprintf(stderr, "Could not remove stale socket %s: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,132 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QThread>
+
+#include <string>
+
+using namespace std;
+
+enum statStage
+{
+    STAT_FACE_SEARCH,           // findObject with the face cascade
+    STAT_LEFT_EYE,              // findObject with the eye cascade
+    STAT_RIGHT_EYE,
+    STAT_LEFT_EYE_GLASSES,      // glasses cascade fallback
+    STAT_RIGHT_EYE_GLASSES,
+    STAT_WARP,                  // warpAffine in detectEyes
+    STAT_FILTER,                // bilateralFilter in detectEyes
+    STAT_RECONSTRUCT,
+    STAT_SIMILARITY,
+    STAT_RESIDUAL,              // reconstructionSimilarity
+    STAT_BATCH,                 // recogniseBatch, per batch
+    STAT_PREDICT,
+    STAT_LEARN,
+    STAT_DETECT_STAGE,          // whole pipeline stages
+    STAT_ALIGN_STAGE,
+    STAT_RECOGNISE_STAGE,
+    STAT_SERVICE_REQUEST,       // recognition service, request read to response queued
+    STAT_COUNT
+};
+
+const int MAX_CAMERAS = 4;      // cameras with their own line in the report
+const int HIST_BUCKETS = 120;   // 4 buckets per power of 2 microseconds, ~12% wide, up to ~35 minutes
+
+/*
+  Lock free latency histogram, recording is a couple of atomic adds so it can stay on in the hot path.
+  Percentiles are read from a snapshot of the buckets and are accurate to the bucket width.
+*/
+class latencyHistogram
+{
+public:
+    latencyHistogram();
+
+    void record(qint64 nsecs);
+    int count() const;
+    int maxMicros() const;
+    // upper bound of the bucket holding the p-th percentile, microseconds
+    int percentile(double p) const;
+
+    static int bucket(unsigned int micros);
+    static int bucketLimit(int bucket);     // first microsecond value of the next bucket
+
+private:
+    QAtomicInt buckets[HIST_BUCKETS];
+    QAtomicInt samples;
+    QAtomicInt maximum;
+};
+
+// One histogram per statStage, and per camera the capture rate and the latency of whole frames.
+class latencyStats
+{
+public:
+    latencyStats() : cameras(0) {}
+
+    void record(int stage, qint64 nsecs) { histograms[stage].record(nsecs); }
+    const latencyHistogram &histogram(int stage) const { return histograms[stage]; }
+
+    void setCameras(int count) { cameras = count < MAX_CAMERAS ? count : MAX_CAMERAS; }
+    // frame submitted to its result, camera must be < MAX_CAMERAS
+    void recordFrame(int camera, qint64 nsecs) { frames[camera].record(nsecs); }
+    void setFrameRate(int camera, double fps) { frameRates[camera] = (int)(fps * 10 + 0.5); }
+
+    // one line per stage: name count p50 p90 p99 max (microseconds)
+    // then one per camera: name fps frames p50 p90 p99 max
+    string report() const;
+    static const char *stageName(int stage);
+
+private:
+    latencyHistogram histograms[STAT_COUNT];
+    latencyHistogram frames[MAX_CAMERAS];
+    QAtomicInt frameRates[MAX_CAMERAS];     // tenths of a frame per second
+    QAtomicInt cameras;
+};
+
+extern latencyStats stageStats;
+
+// Times the enclosing scope into a stage histogram.
+class scopedLatency
+{
+public:
+    explicit scopedLatency(int stage) : stage(stage) { timer.start(); }
+    ~scopedLatency() { stageStats.record(stage, timer.nsecsElapsed()); }
+
+private:
+    int stage;
+    QElapsedTimer timer;
+};
+
+/*
+  Serves stageStats.report() to anything connecting to a Unix domain socket, and/or rewrites
+  a stats file every interval ms, so monitoring can scrape a running unit without a profiler.
+*/
+class statsExporter : public QThread
+{
+public:
+    statsExporter();
+    ~statsExporter();
+
+    // either may be empty to turn that output off
+    bool start(const string socketPath, const string filePath, int interval);
+    void stop();
+
+protected:
+    void run();
+
+private:
+    void writeFile();
+    void serve();
+
+    string socketPath;
+    string filePath;
+    int interval;
+    int listenSocket;
+    QAtomicInt stopping;
+};
+
+// removes a socket left at path by a run that has gone, false if something still listens on it
+bool removeStaleSocket(const string path);
+
+#endif // STATS_H
@@ -0,0 +1,397 @@
+#include "v4l2camera.h"
+
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include <iostream>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/videodev2.h>
+
+using namespace cv;
+using namespace std;
+
+const int V4L2_SPARE_BUFFERS = 3;   //buffers the driver fills while every ring slot holds one
+const int V4L2_MIN_SPARE = 2;       //fewer than this and the driver would drop frames, use VideoCapture instead
+const int V4L2_TIMEOUT = 1000;      //ms to wait for a frame, so the capture thread can see a stop
+
+//formats with a luma plane, best first: planar ones are wrapped in place
+static const unsigned int LUMA_FORMATS[] = {
+    V4L2_PIX_FMT_GREY,
+    V4L2_PIX_FMT_NV12,
+    V4L2_PIX_FMT_YUV420,
+    V4L2_PIX_FMT_YUYV
+};
+static const int LUMA_FORMAT_COUNT = sizeof(LUMA_FORMATS) / sizeof(LUMA_FORMATS[0]);
+
+static int xioctl(int fd, unsigned long request, void *arg)
+{
+    int result;
+    do{
+        result = ioctl(fd, request, arg);
+    }while (result < 0 && errno == EINTR);
+    return result;
+}
+
+v4l2Camera::v4l2Camera()
+{
+    fd = -1;
+    format = 0;
+    width = 0;
+    height = 0;
+    stride = 0;
+    file = NULL;
+    frameBytes = 0;
+    frameInterval = 0;
+}
+
+v4l2Camera::~v4l2Camera()
+{
+    release();
+}
+
+/*
+  opens the device, picks a luma format near width x height, maps the driver buffers and starts streaming
+  @params - device(video device number); width, height(requested size, the driver may adjust it); slots(frame ring size)
+  @returns - false if the device can't be used, the caller should fall back to VideoCapture
+*/
+bool v4l2Camera::open(int device, int width, int height, int slots)
+{
+    release();
+    ostringstream path;
+    path << "/dev/video" << device;
+    fd = ::open(path.str().c_str(), O_RDWR | O_NONBLOCK);
+    if (fd < 0){
+        return false;
+    }
+
+    v4l2_capability capability;
+    memset(&capability, 0, sizeof(capability));
+    unsigned int caps = 0;
+    if (xioctl(fd, VIDIOC_QUERYCAP, &capability) == 0){
+        caps = capability.capabilities;
+#ifdef V4L2_CAP_DEVICE_CAPS
+        //3.3+ headers, this node's own capabilities rather than the whole device's
+        if (capability.capabilities & V4L2_CAP_DEVICE_CAPS){
+            caps = capability.device_caps;
+        }
+#endif
+    }
+    if (!(caps & V4L2_CAP_VIDEO_CAPTURE) || !(caps & V4L2_CAP_STREAMING) || !chooseFormat(width, height) ||
+            !mapBuffers(slots + V4L2_SPARE_BUFFERS, slots)){
+        release();
+        return false;
+    }
+
+    v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (xioctl(fd, VIDIOC_STREAMON, &type) < 0){
+        fprintf(stderr, "Could not start %s: %s\n", path.str().c_str(), strerror(errno));
+        release();
+        return false;
+    }
+    cout << "Stream " << device << " opened sucessfully (V4L2 " << formatName() << " " << this->width << "x"
+         << this->height << ")" << endl;
+    return true;
+}
+
+/*
+  opens a file of raw frames as a camera, for testing without a device
+  @params - path; format(fourcc name); width, height(of the frames in the file); slots(frame ring size); fps(replay rate)
+  @returns - false if the format is unknown or the file holds less than one frame
+*/
+bool v4l2Camera::openFile(const string path, const string format, int width, int height, int slots, int fps)
+{
+    release();
+    unsigned int fourcc = format.size() == 4 ? v4l2_fourcc(format[0], format[1], format[2], format[3]) : 0;
+    int sampleBytes = 1;
+    if (fourcc == V4L2_PIX_FMT_GREY){
+        frameBytes = (size_t)width * height;
+    }else if (fourcc == V4L2_PIX_FMT_NV12 || fourcc == V4L2_PIX_FMT_YUV420){
+        frameBytes = (size_t)width * height * 3 / 2;
+    }else if (fourcc == V4L2_PIX_FMT_YUYV){
+        frameBytes = (size_t)width * height * 2;
+        sampleBytes = 2;
+    }else{
+        fprintf(stderr, "Unknown raw camera format: %s\n", format.c_str());
+        return false;
+    }
+    file = fopen(path.c_str(), "rb");
+    if (file == NULL || fseek(file, 0, SEEK_END) != 0 || ftell(file) < (long)frameBytes){
+        fprintf(stderr, "Could not read raw camera frames: %s\n", path.c_str());
+        release();
+        return false;
+    }
+    rewind(file);
+    this->format = fourcc;
+    this->width = width;
+    this->height = height;
+    stride = width * sampleBytes;
+    frameInterval = fps > 0 ? 1000000 / fps : 0;
+    for (int i = 0; i < slots + V4L2_SPARE_BUFFERS; i++){
+        buffers.push_back(new uchar[frameBytes]);
+        lengths.push_back(frameBytes);
+    }
+    queued.assign(buffers.size(), true);
+    slotBuffers.assign(slots, -1);
+    return true;
+}
+
+/*
+  stops streaming and unmaps the buffers, grey frames handed out must no longer be in use
+*/
+void v4l2Camera::release()
+{
+    if (file != NULL){
+        for (size_t i = 0; i < buffers.size(); i++){
+            delete[] buffers[i];
+        }
+        buffers.clear();
+        lengths.clear();
+        slotBuffers.clear();
+        queued.clear();
+        fclose(file);
+        file = NULL;
+        return;
+    }
+    if (fd < 0){
+        return;
+    }
+    v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    xioctl(fd, VIDIOC_STREAMOFF, &type);
+    for (size_t i = 0; i < buffers.size(); i++){
+        munmap(buffers[i], lengths[i]);
+    }
+    buffers.clear();
+    lengths.clear();
+    slotBuffers.clear();
+    ::close(fd);
+    fd = -1;
+}
+
+/*
+  takes the first luma format in LUMA_FORMATS the device lists
+  @params - width, height(requested)
+  @returns - false if it has none of them
+*/
+bool v4l2Camera::chooseFormat(int width, int height)
+{
+    int best = LUMA_FORMAT_COUNT;
+    v4l2_fmtdesc description;
+    memset(&description, 0, sizeof(description));
+    description.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    while (xioctl(fd, VIDIOC_ENUM_FMT, &description) == 0){
+        for (int i = 0; i < best; i++){
+            if (description.pixelformat == LUMA_FORMATS[i]){
+                best = i;
+                break;
+            }
+        }
+        description.index++;
+    }
+    if (best == LUMA_FORMAT_COUNT){
+        return false;
+    }
+
+    v4l2_format requested;
+    memset(&requested, 0, sizeof(requested));
+    requested.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    requested.fmt.pix.width = width;
+    requested.fmt.pix.height = height;
+    requested.fmt.pix.pixelformat = LUMA_FORMATS[best];
+    requested.fmt.pix.field = V4L2_FIELD_NONE;
+    if (xioctl(fd, VIDIOC_S_FMT, &requested) < 0 || requested.fmt.pix.pixelformat != LUMA_FORMATS[best]){
+        return false;
+    }
+    format = requested.fmt.pix.pixelformat;
+    this->width = requested.fmt.pix.width;
+    this->height = requested.fmt.pix.height;
+    stride = requested.fmt.pix.bytesperline;
+    int sampleBytes = format == V4L2_PIX_FMT_YUYV ? 2 : 1;
+    if (stride < this->width * sampleBytes){
+        stride = this->width * sampleBytes;
+    }
+    return true;
+}
+
+/*
+  maps count driver buffers and queues them all
+  @params - count(buffers to ask for); slots(ring slots that will each hold one)
+  @returns - false if the driver gives too few to keep streaming while the slots hold theirs
+*/
+bool v4l2Camera::mapBuffers(int count, int slots)
+{
+    v4l2_requestbuffers request;
+    memset(&request, 0, sizeof(request));
+    request.count = count;
+    request.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    request.memory = V4L2_MEMORY_MMAP;
+    if (xioctl(fd, VIDIOC_REQBUFS, &request) < 0 || (int)request.count < slots + V4L2_MIN_SPARE){
+        return false;
+    }
+
+    for (unsigned int i = 0; i < request.count; i++){
+        v4l2_buffer buffer;
+        memset(&buffer, 0, sizeof(buffer));
+        buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buffer.memory = V4L2_MEMORY_MMAP;
+        buffer.index = i;
+        if (xioctl(fd, VIDIOC_QUERYBUF, &buffer) < 0){
+            return false;
+        }
+        void *start = mmap(NULL, buffer.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, buffer.m.offset);
+        if (start == MAP_FAILED){
+            return false;
+        }
+        buffers.push_back((uchar*)start);
+        lengths.push_back(buffer.length);
+        //too small for the format, the luma header would run off the end
+        if (buffer.length < (size_t)stride * height || !queue(i)){
+            return false;
+        }
+    }
+    slotBuffers.assign(slots, -1);
+    return true;
+}
+
+bool v4l2Camera::queue(int index)
+{
+    if (file != NULL){
+        queued[index] = true;
+        return true;
+    }
+    v4l2_buffer buffer;
+    memset(&buffer, 0, sizeof(buffer));
+    buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buffer.memory = V4L2_MEMORY_MMAP;
+    buffer.index = index;
+    return xioctl(fd, VIDIOC_QBUF, &buffer) == 0;
+}
+
+/*
+  waits up to V4L2_TIMEOUT for a filled buffer, corrupt frames go straight back to the driver
+  @returns - buffer index, -1 if no frame
+*/
+int v4l2Camera::dequeue()
+{
+    if (file != NULL){
+        //stand-in: the next frame of the file goes into the first free buffer, at the camera's pace
+        usleep(frameInterval);
+        int index = (int)(find(queued.begin(), queued.end(), true) - queued.begin());
+        if (index == (int)queued.size()){
+            return -1;
+        }
+        if (fread(buffers[index], 1, frameBytes, file) != frameBytes){
+            rewind(file);
+            if (fread(buffers[index], 1, frameBytes, file) != frameBytes){
+                return -1;
+            }
+        }
+        queued[index] = false;
+        return index;
+    }
+    pollfd waitFd;
+    waitFd.fd = fd;
+    waitFd.events = POLLIN;
+    waitFd.revents = 0;
+    if (poll(&waitFd, 1, V4L2_TIMEOUT) <= 0){
+        return -1;
+    }
+    v4l2_buffer buffer;
+    memset(&buffer, 0, sizeof(buffer));
+    buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buffer.memory = V4L2_MEMORY_MMAP;
+    if (xioctl(fd, VIDIOC_DQBUF, &buffer) < 0){
+        return -1;
+    }
+    if (buffer.flags & V4L2_BUF_FLAG_ERROR){
+        queue(buffer.index);
+        return -1;
+    }
+    return buffer.index;
+}
+
+/*
+  the slot is free (no reader holds it) so its old buffer can go back to the driver
+  @params - slot(ring slot being written); grey(out, the slot's image)
+  @returns - false if no frame arrived
+*/
+bool v4l2Camera::read(int slot, Mat &grey)
+{
+    if (!isOpened()){
+        return false;
+    }
+    if (slotBuffers[slot] >= 0){
+        queue(slotBuffers[slot]);
+        slotBuffers[slot] = -1;
+    }
+    int index = dequeue();
+    if (index < 0){
+        return false;
+    }
+    const uchar *data = buffers[index];
+    if (format == V4L2_PIX_FMT_YUYV){
+        //Y U Y V, every other byte is luma
+        grey.create(height, width, CV_8U);
+        for (int y = 0; y < height; y++){
+            const uchar *in = data + y * stride;
+            uchar *out = grey.ptr<uchar>(y);
+            for (int x = 0; x < width; x++){
+                out[x] = in[x * 2];
+            }
+        }
+    }else{
+        //luma plane comes first, the frame is a header onto the driver's buffer
+        grey = Mat(height, width, CV_8U, (void*)data, stride);
+    }
+    slotBuffers[slot] = index;
+    return true;
+}
+
+void v4l2Camera::skip()
+{
+    int index = dequeue();
+    if (index >= 0){
+        queue(index);
+    }
+}
+
+/*
+  converts the slot's buffer to BGR, grey frames (or a buffer the conversion can't read) come out grey
+  @params - slot(pinned by the caller, so its buffer is stable); grey(the slot's frame); bgr(out)
+*/
+void v4l2Camera::colour(int slot, const Mat &grey, Mat &bgr)
+{
+    int index = (slot >= 0 && slot < (int)slotBuffers.size()) ? slotBuffers[slot] : -1;
+    if (index < 0 || format == V4L2_PIX_FMT_GREY){
+        cvtColor(grey, bgr, CV_GRAY2BGR);
+        return;
+    }
+    uchar *data = buffers[index];
+    if (format == V4L2_PIX_FMT_YUYV){
+        cvtColor(Mat(height, width, CV_8UC2, data, stride), bgr, CV_YUV2BGR_YUYV);
+    }else if (stride == width && lengths[index] >= (size_t)width * height * 3 / 2){
+        //chroma planes follow the luma, the conversion assumes they are packed
+        Mat planes(height * 3 / 2, width, CV_8U, data);
+        cvtColor(planes, bgr, format == V4L2_PIX_FMT_NV12 ? CV_YUV2BGR_NV12 : CV_YUV2BGR_I420);
+    }else{
+        cvtColor(grey, bgr, CV_GRAY2BGR);
+    }
+}
+
+string v4l2Camera::formatName() const
+{
+    char name[5];
+    for (int i = 0; i < 4; i++){
+        name[i] = (char)((format >> (i * 8)) & 0xff);
+    }
+    name[4] = '\0';
+    return string(name);
+}
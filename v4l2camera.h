@@ -0,0 +1,68 @@
+#ifndef V4L2CAMERA_H
+#define V4L2CAMERA_H
+
+#include "opencv2/core/core.hpp"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace cv;
+using namespace std;
+
+/*
+  Native V4L2 capture into the driver's own mmap'd buffers. Frames are handed out as grey Mats:
+  for planar formats (GREY, NV12, YUV420) a header straight onto the Y plane, for YUYV the Y
+  samples are picked out in one pass. Either way there is no BGR decode, colour is only made
+  by colour() for the preview.
+  Each frameRing slot keeps the buffer it was read into until the slot is written again, so a
+  pinned frame stays valid without a copy. The driver gets V4L2_SPARE_BUFFERS more than there
+  are slots to keep filling.
+  openFile() stands in for a camera with raw frames from a file, filled into heap buffers
+  through the same queue/dequeue cycle, so read() and colour() can be checked without a device.
+*/
+class v4l2Camera
+{
+public:
+    v4l2Camera();
+    ~v4l2Camera();
+
+    // opens /dev/video<device> for a ring of slots, false if it can't stream a format with a luma plane
+    bool open(int device, int width, int height, int slots);
+    // raw frames back to back in format (GREY, NV12, YU12 or YUYV), replayed in a loop at fps
+    bool openFile(const string path, const string format, int width, int height, int slots, int fps = 30);
+    void release();
+    bool isOpened() const { return fd >= 0 || file != NULL; }
+
+    // capture thread: requeues the buffer slot held, waits for the next frame and points grey at its luma
+    bool read(int slot, Mat &grey);
+    // capture thread: takes a frame and hands it straight back, for when every slot is pinned
+    void skip();
+    // BGR copy of the frame slot holds, slot must be pinned by the caller
+    void colour(int slot, const Mat &grey, Mat &bgr);
+
+    string formatName() const;
+
+private:
+    bool chooseFormat(int width, int height);
+    bool mapBuffers(int count, int slots);
+    int dequeue();
+    bool queue(int buffer);
+
+    int fd;
+    unsigned int format;        // V4L2_PIX_FMT_*
+    int width;
+    int height;
+    int stride;                 // bytes per line of the first plane
+    vector<uchar*> buffers;
+    vector<size_t> lengths;
+    vector<int> slotBuffers;    // driver buffer each ring slot holds, -1 for none
+
+    //file stand-in
+    FILE *file;
+    size_t frameBytes;
+    int frameInterval;          // us between frames
+    vector<bool> queued;        // buffers the stand-in may fill
+};
+
+#endif // V4L2CAMERA_H